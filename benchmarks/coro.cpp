@@ -0,0 +1,98 @@
+// coro.cpp
+//
+// Compares resume cost and frame size of the switch based activities with the coroutine based ones.
+
+#include "proto_activities.h"
+#include "proto_activities_coro.h"
+
+#include <chrono>
+#include <iostream>
+
+namespace {
+
+constexpr int num_ticks = 10000000;
+
+unsigned counter{};
+
+// Switch based activities
+
+pa_activity (Leaf, pa_ctx()) {
+    pa_always {
+        ++counter;
+    } pa_always_end;
+} pa_end
+
+pa_activity (Nest1, pa_ctx(pa_use(Leaf))) {
+    pa_run (Leaf);
+} pa_end
+
+pa_activity (Nest2, pa_ctx(pa_use(Nest1))) {
+    pa_run (Nest1);
+} pa_end
+
+pa_activity (Nest3, pa_ctx(pa_use(Nest2))) {
+    pa_run (Nest2);
+} pa_end
+
+pa_activity (Nest4, pa_ctx(pa_use(Nest3))) {
+    pa_run (Nest3);
+} pa_end
+
+// Coroutine based activities
+
+proto_activities::coro::Activity CoroLeaf() {
+    while (true) {
+        ++counter;
+        co_await proto_activities::coro::pause;
+    }
+}
+
+proto_activities::coro::Activity CoroNest(int depth) {
+    if (depth == 0) {
+        co_await CoroLeaf();
+    } else {
+        co_await CoroNest(depth - 1);
+    }
+}
+
+// Helpers
+
+template <typename Tick>
+void measure(const char* name, Tick tick) {
+    counter = 0;
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < num_ticks; ++i) {
+        tick();
+    }
+    const auto end = std::chrono::steady_clock::now();
+    const auto ns = std::chrono::duration<double, std::nano>(end - start).count() / num_ticks;
+    if (counter != num_ticks) {
+        std::cout << name << ": wrong number of resumes" << std::endl;
+    }
+    std::cout << name << ": " << ns << " ns/tick" << std::endl;
+}
+
+} // namespace
+
+int main() {
+    auto& pool = proto_activities::coro::internal::frame_pool();
+
+    pa_use(Leaf);
+    measure("switch depth 0", [&] { pa_tick(Leaf); });
+    std::cout << "switch depth 0: " << sizeof(Leaf_inst) << " bytes" << std::endl;
+
+    pa_use(Nest4);
+    measure("switch depth 4", [&] { pa_tick(Nest4); });
+    std::cout << "switch depth 4: " << sizeof(Nest4_inst) << " bytes" << std::endl;
+
+    {
+        auto leaf = CoroLeaf();
+        measure("coro depth 0", [&] { leaf.tick(); });
+        std::cout << "coro depth 0: " << pool.in_use() << " bytes" << std::endl;
+    }
+    {
+        auto nest = CoroNest(3);
+        measure("coro depth 4", [&] { nest.tick(); });
+        std::cout << "coro depth 4: " << pool.in_use() << " bytes" << std::endl;
+    }
+}
@@ -0,0 +1,85 @@
+/* resume.c
+ *
+ * Measures the cost of resuming deep, wide and long activities - build with and without PA_USE_COMPUTED_GOTO.
+ */
+
+#include "shapes.h"
+
+#include <stdio.h>
+#include <time.h>
+
+#define NUM_TICKS 10000000
+
+/* Long */
+
+pa_activity (Long, pa_ctx()) {
+    pa_repeat {
+        ++counter; pa_pause;
+        ++counter; pa_pause;
+        ++counter; pa_pause;
+        ++counter; pa_pause;
+        ++counter; pa_pause;
+        ++counter; pa_pause;
+        ++counter; pa_pause;
+        ++counter; pa_pause;
+        ++counter; pa_pause;
+        ++counter; pa_pause;
+        ++counter; pa_pause;
+        ++counter; pa_pause;
+        ++counter; pa_pause;
+        ++counter; pa_pause;
+        ++counter; pa_pause;
+        ++counter; pa_pause;
+        ++counter; pa_pause;
+        ++counter; pa_pause;
+        ++counter; pa_pause;
+        ++counter; pa_pause;
+        ++counter; pa_pause;
+        ++counter; pa_pause;
+        ++counter; pa_pause;
+        ++counter; pa_pause;
+        ++counter; pa_pause;
+        ++counter; pa_pause;
+        ++counter; pa_pause;
+        ++counter; pa_pause;
+        ++counter; pa_pause;
+        ++counter; pa_pause;
+        ++counter; pa_pause;
+        ++counter; pa_pause;
+    }
+} pa_end;
+
+/* Helpers */
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+#define measure(name, nm, resumes) { \
+        pa_use(nm); \
+        pa_init(nm); \
+        counter = 0; \
+        const double start = now_ns(); \
+        for (int i = 0; i < NUM_TICKS; ++i) { \
+            pa_tick(nm); \
+        } \
+        const double ns = (now_ns() - start) / NUM_TICKS; \
+        if (counter != NUM_TICKS * (resumes)) { \
+            printf("%s: wrong number of resumes\n", name); \
+        } \
+        printf("%s: %.2f ns/tick, %.2f ns/resume, %zu bytes\n", name, ns, ns / (resumes), sizeof(_pa_inst_name(nm))); \
+    }
+
+int main(int argc, char* argv[]) {
+#ifdef PA_USE_COMPUTED_GOTO
+    printf("dispatch: computed goto\n");
+#else
+    printf("dispatch: switch\n");
+#endif
+    measure("deep 8", Deep8, 1);
+    measure("wide 8", Wide, 8);
+    measure("long 32", Long, 1);
+    return 0;
+}
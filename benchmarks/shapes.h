@@ -0,0 +1,44 @@
+/* shapes.h
+ *
+ * Activity shapes shared by the benchmarks - every resume of a leaf increments `counter`.
+ */
+
+#pragma once
+
+#include "proto_activities.h"
+
+static unsigned counter;
+
+/* Deep */
+
+pa_activity (Leaf, pa_ctx()) {
+    pa_always {
+        ++counter;
+    } pa_always_end;
+} pa_end;
+
+pa_activity (Deep1, pa_ctx(pa_use(Leaf))) { pa_run (Leaf); } pa_end;
+pa_activity (Deep2, pa_ctx(pa_use(Deep1))) { pa_run (Deep1); } pa_end;
+pa_activity (Deep3, pa_ctx(pa_use(Deep2))) { pa_run (Deep2); } pa_end;
+pa_activity (Deep4, pa_ctx(pa_use(Deep3))) { pa_run (Deep3); } pa_end;
+pa_activity (Deep5, pa_ctx(pa_use(Deep4))) { pa_run (Deep4); } pa_end;
+pa_activity (Deep6, pa_ctx(pa_use(Deep5))) { pa_run (Deep5); } pa_end;
+pa_activity (Deep7, pa_ctx(pa_use(Deep6))) { pa_run (Deep6); } pa_end;
+pa_activity (Deep8, pa_ctx(pa_use(Deep7))) { pa_run (Deep7); } pa_end;
+
+/* Wide */
+
+pa_activity (Wide, pa_ctx(pa_co_res(8);
+                          pa_use_as(Leaf, L1); pa_use_as(Leaf, L2); pa_use_as(Leaf, L3); pa_use_as(Leaf, L4);
+                          pa_use_as(Leaf, L5); pa_use_as(Leaf, L6); pa_use_as(Leaf, L7); pa_use_as(Leaf, L8))) {
+    pa_co(8) {
+        pa_with_as (Leaf, L1);
+        pa_with_as (Leaf, L2);
+        pa_with_as (Leaf, L3);
+        pa_with_as (Leaf, L4);
+        pa_with_as (Leaf, L5);
+        pa_with_as (Leaf, L6);
+        pa_with_as (Leaf, L7);
+        pa_with_as (Leaf, L8);
+    } pa_co_end;
+} pa_end;
@@ -0,0 +1,155 @@
+/* suite.c
+ *
+ * Measures ns/tick of representative activity shapes and prints the results as JSON - build as C, C++14 and C++17.
+ */
+
+#include "shapes.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define NUM_TICKS 5000000
+
+static bool never;
+
+/* Wide */
+
+pa_activity (WideWeak, pa_ctx(pa_co_res(8);
+                              pa_use_as(Leaf, L1); pa_use_as(Leaf, L2); pa_use_as(Leaf, L3); pa_use_as(Leaf, L4);
+                              pa_use_as(Leaf, L5); pa_use_as(Leaf, L6); pa_use_as(Leaf, L7); pa_use_as(Leaf, L8))) {
+    pa_co(8) {
+        pa_with_as (Leaf, L1);
+        pa_with_weak_as (Leaf, L2);
+        pa_with_weak_as (Leaf, L3);
+        pa_with_weak_as (Leaf, L4);
+        pa_with_weak_as (Leaf, L5);
+        pa_with_weak_as (Leaf, L6);
+        pa_with_weak_as (Leaf, L7);
+        pa_with_weak_as (Leaf, L8);
+    } pa_co_end;
+} pa_end;
+
+/* Preemption */
+
+pa_activity (WhenAbort, pa_ctx(pa_use(Leaf))) {
+    pa_when_abort (never, Leaf);
+} pa_end;
+
+pa_activity (WhenSuspend, pa_ctx(pa_use(Leaf))) {
+    pa_when_suspend (never, Leaf);
+} pa_end;
+
+/* Timing */
+
+pa_activity (EveryMs, pa_ctx_tm()) {
+    pa_every_ms (1) {
+        ++counter;
+    } pa_every_end;
+} pa_end;
+
+/* Signals */
+
+#ifdef _PA_ENABLE_CPP
+
+pa_activity (SignalWriter, pa_ctx(), pa_signal& s1, pa_signal& s2, pa_signal& s3, pa_signal& s4) {
+    pa_always {
+        pa_emit (s1);
+        pa_emit (s2);
+        pa_emit (s3);
+        pa_emit (s4);
+    } pa_always_end;
+} pa_end;
+
+pa_activity (SignalReader, pa_ctx(), pa_signal& s1, pa_signal& s2, pa_signal& s3, pa_signal& s4) {
+    pa_always {
+        counter += s1 + s2 + s3 + s4;
+    } pa_always_end;
+} pa_end;
+
+/* Every signal is read by 8 trails, and the enter callback counts the entries of the owner */
+pa_activity (Signals, pa_ctx(pa_enter_res; pa_co_res(9); pa_use(SignalWriter);
+                             pa_use_as(SignalReader, R1); pa_use_as(SignalReader, R2); pa_use_as(SignalReader, R3);
+                             pa_use_as(SignalReader, R4); pa_use_as(SignalReader, R5); pa_use_as(SignalReader, R6);
+                             pa_use_as(SignalReader, R7); pa_use_as(SignalReader, R8);
+                             pa_def_signal(s1); pa_def_signal(s2); pa_def_signal(s3); pa_def_signal(s4))) {
+    pa_enter {
+        ++counter;
+    };
+    pa_co(9) {
+        pa_with (SignalWriter, pa_self.s1, pa_self.s2, pa_self.s3, pa_self.s4);
+        pa_with_as (SignalReader, R1, pa_self.s1, pa_self.s2, pa_self.s3, pa_self.s4);
+        pa_with_as (SignalReader, R2, pa_self.s1, pa_self.s2, pa_self.s3, pa_self.s4);
+        pa_with_as (SignalReader, R3, pa_self.s1, pa_self.s2, pa_self.s3, pa_self.s4);
+        pa_with_as (SignalReader, R4, pa_self.s1, pa_self.s2, pa_self.s3, pa_self.s4);
+        pa_with_as (SignalReader, R5, pa_self.s1, pa_self.s2, pa_self.s3, pa_self.s4);
+        pa_with_as (SignalReader, R6, pa_self.s1, pa_self.s2, pa_self.s3, pa_self.s4);
+        pa_with_as (SignalReader, R7, pa_self.s1, pa_self.s2, pa_self.s3, pa_self.s4);
+        pa_with_as (SignalReader, R8, pa_self.s1, pa_self.s2, pa_self.s3, pa_self.s4);
+    } pa_co_end;
+} pa_end;
+
+#endif
+
+/* Helpers */
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+#if !defined(__cplusplus)
+#define MODE "c"
+#define SKIPPED "{\"name\": \"signals fan-out 4x8 pa_enter_res\", \"reason\": \"signals are C++ only\"}"
+#elif __cplusplus >= 201703L
+#define MODE "c++17"
+#else
+#define MODE "c++14"
+#endif
+
+#ifndef SKIPPED
+#define SKIPPED ""
+#endif
+
+#ifdef PA_USE_COMPUTED_GOTO
+#define DISPATCH "computed goto"
+#else
+#define DISPATCH "switch"
+#endif
+
+static const char* separator = "";
+
+#define measure(name, nm, resumes) { \
+        pa_use(nm); \
+        pa_init(nm); \
+        counter = 0; \
+        const double start = now_ns(); \
+        for (pa_time_t i = 0; i < NUM_TICKS; ++i) { \
+            pa_tick_tm(i, nm); \
+        } \
+        const double ns = (now_ns() - start) / NUM_TICKS; \
+        if (counter != NUM_TICKS * (resumes)) { \
+            fprintf(stderr, "%s: wrong number of resumes\n", name); \
+            exit(1); \
+        } \
+        printf("%s\n    {\"name\": \"%s\", \"ns_per_tick\": %.2f, \"resumes_per_tick\": %d, \"frame_bytes\": %zu}", \
+               separator, name, ns, resumes, sizeof(_pa_inst_name(nm))); \
+        separator = ","; \
+    }
+
+int main(int argc, char* argv[]) {
+    printf("{\n  \"mode\": \"%s\",\n  \"dispatch\": \"%s\",\n  \"ticks\": %d,\n  \"skipped\": [%s],\n  \"results\": [",
+           MODE, DISPATCH, NUM_TICKS, SKIPPED);
+    measure("deep pa_run 8", Deep8, 1);
+    measure("wide pa_co strong 8", Wide, 8);
+    measure("wide pa_co weak 1+7", WideWeak, 8);
+    measure("pa_when_abort", WhenAbort, 1);
+    measure("pa_when_suspend", WhenSuspend, 1);
+    measure("pa_every_ms", EveryMs, 1);
+#ifdef _PA_ENABLE_CPP
+    measure("signals fan-out 4x8 pa_enter_res", Signals, 4 * 8 + 1);
+#endif
+    printf("\n  ]\n}\n");
+    return 0;
+}
@@ -0,0 +1,89 @@
+// budget.cpp
+
+#include "proto_activities.h"
+
+#include <iostream>
+#include <iomanip>
+
+// Activities
+
+pa_activity (Filter, pa_ctx(float samples[16]; uint8_t next), float input, float& output) {
+    pa_always {
+        pa_self.samples[pa_self.next++ % 16] = input;
+        output = 0;
+        for (auto sample : pa_self.samples) {
+            output += sample / 16;
+        }
+    } pa_always_end;
+} pa_end
+
+pa_activity (Monitor, pa_ctx_tm(pa_signal_res; pa_def_signal(alarm); pa_def_val_signal(float, level)), float value) {
+    pa_every_ms (100) {
+        if (value > 10) {
+            pa_emit_val(pa_self.level, value - 10);
+            pa_emit(pa_self.alarm);
+        }
+    } pa_every_end;
+} pa_end
+
+pa_activity (Blink, pa_ctx(pa_defer_res), bool* led) {
+    pa_defer {
+        *led = false;
+    };
+    pa_always {
+        *led = !*led;
+    } pa_always_end;
+} pa_end
+
+pa_activity (Main, pa_ctx_tm(pa_co_res(3); float input; float output; bool led;
+                             pa_use(Filter); pa_use(Monitor); pa_use(Blink))) {
+    pa_co(3) {
+        pa_with (Filter, pa_self.input, pa_self.output);
+        pa_with (Monitor, pa_self.output);
+        pa_with_weak (Blink, &pa_self.led);
+    } pa_co_end;
+} pa_end
+
+// Budget
+
+// Fails to compile once the whole activity tree needs more than it takes today - pointers make it ABI dependent.
+#if UINTPTR_MAX > 0xffffffff
+pa_budget(Main, 200);
+#else
+pa_budget(Main, 168);
+#endif
+
+// Report
+
+template <typename T>
+void print_layout(const char* name, const T& frame) {
+    const auto layout = proto_activities::frame_layout(frame);
+    std::cout << std::left << std::setw(10) << name << std::right
+              << std::setw(8) << layout.total
+              << std::setw(10) << layout.control
+              << std::setw(8) << layout.time
+              << std::setw(8) << layout.co
+              << std::setw(12) << layout.lifecycle
+              << std::setw(10) << layout.signals
+              << std::setw(10) << layout.context << std::endl;
+}
+
+int main() {
+    pa_use(Main);
+
+    std::cout << std::left << std::setw(10) << "activity" << std::right
+              << std::setw(8) << "total"
+              << std::setw(10) << "control"
+              << std::setw(8) << "time"
+              << std::setw(8) << "co"
+              << std::setw(12) << "lifecycle"
+              << std::setw(10) << "signals"
+              << std::setw(10) << "context" << std::endl;
+
+    print_layout("Main", Main_inst);
+    print_layout("Filter", Main_inst.Filter_inst);
+    print_layout("Monitor", Main_inst.Monitor_inst);
+    print_layout("Blink", Main_inst.Blink_inst);
+
+    return 0;
+}
@@ -12,19 +12,43 @@
 #define _PA_ENABLE_CPP
 #endif
 
+/* The coroutine based activities of proto_activities_coro.h need a C++20 compiler */
+#if defined(_PA_ENABLE_CPP) && defined(__cpp_impl_coroutine)
+#define _PA_ENABLE_CORO
+#endif
+
+/* #define PA_USE_WAKE_SETS to skip sub-activities which wait for a deadline, a signal or forever */
+
+/* #define PA_USE_COMPUTED_GOTO to resume activities by jumping directly to the stored label (GCC and Clang only) */
+
+/* #define PA_USE_SMALL_PC to store the program counter in one byte - limits activities to 254 resume points */
+
+/* #define PA_PROFILE to measure calls and time per activity - see pa_profile_dump */
+
+/* #define PA_TRACE to record the ticks as a timeline - see pa_trace_attach and pa_trace_write_json */
+
 /* Includes */
 
 #include <stdbool.h>
 #include <stdint.h> /* for uint16_t etc. */
 #include <string.h> /* for memset */
 #ifdef _PA_ENABLE_CPP
-#include <functional> /* for std::function */
+#include <cassert> /* for assert */
+#include <cstddef> /* for std::nullptr_t */
+#include <new> /* for placement new */
+#include <utility> /* for std::move, std::forward */
 #include <type_traits> /* for std::true_type, std::void_t, std::enable_if etc. */
 #endif
 
 /* Types */
 
+#if defined(PA_USE_COMPUTED_GOTO)
+typedef const void* pa_pc_t;
+#elif defined(PA_USE_SMALL_PC)
+typedef uint8_t pa_pc_t;
+#else
 typedef uint16_t pa_pc_t;
+#endif
 typedef int8_t pa_rc_t;
 typedef uint32_t pa_time_t;
 
@@ -33,22 +57,32 @@ typedef uint32_t pa_time_t;
 #define PA_RC_WAIT ((pa_rc_t)-1)
 #define PA_RC_DONE ((pa_rc_t)0)
 
+#define PA_TIME_INFINITE ((pa_time_t)-1)
+
+#ifndef PA_USE_COMPUTED_GOTO
+#define _PA_PC_ABORT ((pa_pc_t)-1)
+#else
+#define _PA_PC_ABORT ((pa_pc_t)1)
+#endif
+
 /* Internals */
 
 #define _pa_frame_name(nm) nm##_frame
 #define _pa_frame_type(nm) struct _pa_frame_name(nm)
 #define _pa_inst_name(nm) nm##_inst
 #define _pa_inst_ptr(nm) &(pa_this->_pa_inst_name(nm))
-#define _pa_call(nm, ...) nm(_pa_inst_ptr(nm), pa_current_time_ms, ##__VA_ARGS__)
-#define _pa_call_as(nm, alias, ...) nm(_pa_inst_ptr(alias), pa_current_time_ms, ##__VA_ARGS__)
+#define _pa_concat_(a, b) a##b
+#define _pa_concat(a, b) _pa_concat_(a, b)
+#define _pa_call(nm, ...) _pa_seq_activate(_pa_inst_ptr(nm), _pa_wake_guard(_pa_inst_ptr(nm), pa_current_time_ms, nm(_pa_inst_ptr(nm), pa_current_time_ms, ##__VA_ARGS__)))
+#define _pa_call_as(nm, alias, ...) _pa_seq_activate(_pa_inst_ptr(alias), _pa_wake_guard(_pa_inst_ptr(alias), pa_current_time_ms, nm(_pa_inst_ptr(alias), pa_current_time_ms, ##__VA_ARGS__)))
 #ifndef _PA_ENABLE_CPP
 #define _pa_reset(inst) memset(inst, 0, sizeof(*inst));
-#define _pa_abort(inst) _pa_reset(inst); *inst._pa_pc = 0xffff;
+#define _pa_abort(inst) _pa_reset(inst); *inst._pa_pc = _PA_PC_ABORT;
 #define _pa_static static
 #define _pa_extern extern
 #else
 #define _pa_reset(inst) (inst)->reset();
-#define _pa_abort(inst) _pa_reset(inst); (inst)->_pa_pc = 0xffff;
+#define _pa_abort(inst) _pa_reset(inst); (inst)->_pa_pc = _PA_PC_ABORT;
 #define _pa_static
 #define _pa_extern
 #define _pa_has_field_definer(field) \
@@ -62,6 +96,174 @@ typedef uint32_t pa_time_t;
 #define _pa_has_field(ty, field) proto_activities::internal::has_field_##field<ty>::value
 #endif
 
+/* Presence */
+
+#ifdef _PA_ENABLE_CPP
+namespace proto_activities { namespace internal {
+    /* Counts the entries of the activity owning signals - a signal is present if it was emitted since the last one */
+    struct Epoch {
+        void invoke() {
+            ++value;
+        }
+        uint64_t value{};
+    };
+
+    /* The presence of a signal needs no work to be retracted - it just refers to a past epoch then */
+    struct Presence {
+        explicit Presence(Epoch& epoch) : epoch_(&epoch) {}
+        Presence(const Presence&) = delete;
+        Presence& operator=(const Presence&) {
+            stamp_ = 0;
+            return *this;
+        }
+        bool is_present() const {
+            return stamp_ == epoch_->value + 1;
+        }
+    protected:
+        void mark() {
+            stamp_ = epoch_->value + 1;
+        }
+    private:
+        const Epoch* epoch_;
+        uint64_t stamp_{};
+    };
+} }
+#endif
+
+/* Wake Sets */
+
+#ifdef PA_USE_WAKE_SETS
+
+#define _PA_WAKE_ANY 0 /* enter on every tick */
+#define _PA_WAKE_SLEEP 1 /* enter only for the reasons below - or never if none is set */
+#define _PA_WAKE_AT 2 /* enter once time `at` is reached */
+#define _PA_WAKE_SIG 4 /* enter when signal `sig` is present */
+
+typedef struct {
+    uint8_t mode;
+    pa_time_t at;
+#ifdef _PA_ENABLE_CPP
+    const proto_activities::internal::Presence* sig;
+#endif
+} pa_wake_t;
+
+#ifdef _PA_ENABLE_CPP
+#define _pa_wake_init(mode, at) {mode, at, nullptr}
+#else
+#define _pa_wake_init(mode, at) {mode, at}
+#endif
+
+static inline void _pa_wake_join(pa_wake_t* wake, const pa_wake_t* other) {
+    if (wake->mode == _PA_WAKE_ANY || other->mode == _PA_WAKE_ANY) {
+        wake->mode = _PA_WAKE_ANY;
+        return;
+    }
+    if ((other->mode & _PA_WAKE_AT) && (!(wake->mode & _PA_WAKE_AT) || (int32_t)(other->at - wake->at) < 0)) {
+        wake->at = other->at;
+    }
+#ifdef _PA_ENABLE_CPP
+    if (other->mode & _PA_WAKE_SIG) {
+        if ((wake->mode & _PA_WAKE_SIG) && wake->sig != other->sig) {
+            wake->mode = _PA_WAKE_ANY; /* only one signal is tracked */
+            return;
+        }
+        wake->sig = other->sig;
+    }
+#endif
+    wake->mode |= other->mode;
+}
+
+static inline void _pa_wake_join_at(pa_wake_t* wake, pa_time_t at) {
+    pa_wake_t other = _pa_wake_init(_PA_WAKE_SLEEP | _PA_WAKE_AT, at);
+    _pa_wake_join(wake, &other);
+}
+
+static inline bool _pa_wake_is_asleep(const pa_wake_t* wake, pa_time_t time) {
+    if (wake->mode == _PA_WAKE_ANY) {
+        return false;
+    }
+    if ((wake->mode & _PA_WAKE_AT) && (int32_t)(time - wake->at) >= 0) {
+        return false;
+    }
+#ifdef _PA_ENABLE_CPP
+    if ((wake->mode & _PA_WAKE_SIG) && wake->sig->is_present()) {
+        return false;
+    }
+#endif
+    return true;
+}
+
+static inline pa_time_t _pa_wake_delay(const pa_wake_t* wake, pa_time_t time) {
+    if (!_pa_wake_is_asleep(wake, time)) {
+        return 0;
+    }
+    if (wake->mode & _PA_WAKE_AT) {
+        return wake->at - time;
+    }
+    return PA_TIME_INFINITE;
+}
+
+/* The duration of a wait might depend on the arguments, so waits stay awake and check it on every tick - like they
+   do without wake sets. Only the `_const` variants of the timing statements, whose duration is `fixed`, sleep until
+   their deadline. */
+
+#define _pa_wake_res pa_wake_t _pa_wake;
+#define _pa_wake_reset pa_this->_pa_wake.mode = _PA_WAKE_ANY;
+#define _pa_wake_any pa_this->_pa_wake.mode = _PA_WAKE_ANY;
+#define _pa_wake_never pa_this->_pa_wake.mode = _PA_WAKE_SLEEP;
+#define _pa_wake_at(tm) \
+    pa_this->_pa_wake.mode = _PA_WAKE_SLEEP | _PA_WAKE_AT; \
+    pa_this->_pa_wake.at = tm;
+#define _pa_wake_at_ms(start, ms, fixed) \
+    if (fixed) { \
+        _pa_wake_at((start) + (ms)); \
+    } else { \
+        _pa_wake_any; \
+    }
+#define _pa_wake_from(inst) pa_this->_pa_wake = (inst)->_pa_wake;
+#define _pa_wake_from_at_ms(inst, start, ms, fixed) \
+    _pa_wake_from(inst); \
+    if (fixed) { \
+        _pa_wake_join_at(&pa_this->_pa_wake, (start) + (ms)); \
+    } else { \
+        _pa_wake_any; \
+    }
+#define _pa_wake_guard(inst, time, call) (_pa_wake_is_asleep(&(inst)->_pa_wake, time) ? PA_RC_WAIT : call)
+#define _pa_co_wake_def pa_wake_t _pa_co_wake = _pa_wake_init(_PA_WAKE_SLEEP, 0);
+#define _pa_co_wake_join(inst) _pa_wake_join(&_pa_co_wake, &(inst)->_pa_wake);
+#define _pa_co_wake_apply pa_this->_pa_wake = _pa_co_wake;
+#ifdef _PA_ENABLE_CPP
+#define _pa_wake_cond(cond) proto_activities::internal::wake_cond(pa_this->_pa_wake, cond)
+#else
+#define _pa_wake_cond(cond) (cond)
+#endif
+
+#else
+
+#define _pa_wake_res
+#define _pa_wake_reset
+#define _pa_wake_any
+#define _pa_wake_never
+#define _pa_wake_at(tm)
+#define _pa_wake_at_ms(start, ms, fixed)
+#define _pa_wake_from(inst)
+#define _pa_wake_from_at_ms(inst, start, ms, fixed)
+#define _pa_wake_guard(inst, time, call) call
+#define _pa_co_wake_def
+#define _pa_co_wake_join(inst)
+#define _pa_co_wake_apply
+#define _pa_wake_cond(cond) (cond)
+
+#endif
+
+#define _pa_await_until(cond, start, ms, fixed) \
+    _pa_wake_at_ms(start, ms, fixed); \
+    pa_mark_and_wait; \
+    if (!(cond)) { \
+        _pa_wake_at_ms(start, ms, fixed); \
+        pa_wait; \
+    }
+
 /* Context */
 
 #define pa_ctx(vars...) vars
@@ -87,33 +289,121 @@ typedef uint32_t pa_time_t;
 #define pa_activity_ctx(nm, ...) \
     struct _pa_frame_name(nm) { \
         pa_pc_t _pa_pc; \
+        _pa_wake_res \
         __VA_ARGS__; \
     };
 #else
 namespace proto_activities { namespace internal {
+    /* Frames have no vtable - sections reset their weak trails through the concrete frame type */
     struct AnyFrame {
-        virtual ~AnyFrame() = default;
-        virtual void reset() = 0;
         pa_pc_t _pa_pc{};
+#ifdef PA_USE_WAKE_SETS
+        pa_wake_t _pa_wake{};
+#endif
     };
 } }
 #define pa_activity_ctx(nm, ...) \
-    struct _pa_frame_name(nm) final : proto_activities::internal::AnyFrame { \
-        void reset() final { \
+    struct _pa_frame_name(nm) : proto_activities::internal::AnyFrame { \
+        void reset() { \
             *this = _pa_frame_name(nm){}; \
         } \
         __VA_ARGS__; \
+        _pa_signal_bytes_end \
     };
 #endif
 
+/* Sequential Frames */
+
+#define _pa_seq_n(_1, _2, _3, _4, _5, _6, _7, _8, n, ...) n
+#define _pa_seq_2(a, b) _pa_seq_first(a) _pa_seq_next(b, 2)
+#define _pa_seq_3(a, b, c) _pa_seq_2(a, b) _pa_seq_next(c, 3)
+#define _pa_seq_4(a, b, c, d) _pa_seq_3(a, b, c) _pa_seq_next(d, 4)
+#define _pa_seq_5(a, b, c, d, e) _pa_seq_4(a, b, c, d) _pa_seq_next(e, 5)
+#define _pa_seq_6(a, b, c, d, e, f) _pa_seq_5(a, b, c, d, e) _pa_seq_next(f, 6)
+#define _pa_seq_7(a, b, c, d, e, f, g) _pa_seq_6(a, b, c, d, e, f) _pa_seq_next(g, 7)
+#define _pa_seq_8(a, b, c, d, e, f, g, h) _pa_seq_7(a, b, c, d, e, f, g) _pa_seq_next(h, 8)
+
+/* Lets the frames of 2 to 8 sub-activities share their storage - they must only be run one after another.
+   Only C++ rejects such frames in the trails of pa_co and asserts in debug builds that a frame only takes over the
+   storage from an idle one - in C, running two of them concurrently goes unnoticed.
+   Before C++17, GCC rejects unions of frames with member initializers - the frames are laid out one after another
+   then, so they do not save any memory. */
+#define _pa_seq_frames(...) _pa_concat(_pa_seq_, _pa_seq_n(__VA_ARGS__, 8, 7, 6, 5, 4, 3, 2, 1, 0))(__VA_ARGS__)
+#if defined(_PA_ENABLE_CPP) && __cplusplus < 201703L
+#define pa_use_seq(...) _pa_seq_frames(__VA_ARGS__)
+#else
+#define pa_use_seq(...) union { _pa_seq_frames(__VA_ARGS__) };
+#endif
+
+#ifndef _PA_ENABLE_CPP
+#define _pa_seq_first(nm) _pa_frame_type(nm) _pa_inst_name(nm);
+#define _pa_seq_next(nm, index) _pa_frame_type(nm) _pa_inst_name(nm);
+#define _pa_seq_activate(inst, call) call
+#define _pa_seq_check_trail(alias)
+#else
+namespace proto_activities { namespace internal {
+    /* Leads every frame sharing the storage, so the storage tells which frame is alive in it and where its pc is.
+       Frames are not standard-layout, so the head is read through the bytes of the storage - it is the first base
+       of each frame and thus at its start. */
+    struct SeqHead {
+        uint8_t _pa_seq_index;
+        uint8_t _pa_seq_pc_offset;
+    };
+
+    template <typename T, uint8_t Index>
+    struct SeqFrame final : SeqHead, T {
+        static_assert(std::is_trivially_copyable<T>::value && std::is_trivially_destructible<T>::value,
+                      "frames with lifecycle callbacks or signals can not share their storage");
+
+        SeqFrame() : SeqHead{Index, 0}, T() {
+            _pa_seq_pc_offset = static_cast<uint8_t>(reinterpret_cast<unsigned char*>(static_cast<AnyFrame*>(this)) -
+                                                     reinterpret_cast<unsigned char*>(this));
+        }
+    };
+
+    template <typename T>
+    struct IsSeqFrame : std::false_type {};
+    template <typename T, uint8_t Index>
+    struct IsSeqFrame<SeqFrame<T, Index>> : std::true_type {};
+
+    template <typename T>
+    void seq_activate(T*) {}
+
+    /* A frame starts in the shared storage once it is run while another frame is alive there */
+    template <typename T, uint8_t Index>
+    void seq_activate(SeqFrame<T, Index>* frame) {
+        const unsigned char* storage = reinterpret_cast<const unsigned char*>(static_cast<void*>(frame));
+        SeqHead head;
+        memcpy(&head, storage, sizeof(head));
+        if (head._pa_seq_index != Index) {
+#ifndef NDEBUG
+            pa_pc_t pc;
+            memcpy(&pc, storage + head._pa_seq_pc_offset, sizeof(pc));
+            assert((pc == 0 || pc == _PA_PC_ABORT) && "frames of pa_use_seq must only run one after another");
+#endif
+            new (frame) SeqFrame<T, Index>();
+        }
+    }
+} }
+#define _pa_seq_first(nm) proto_activities::internal::SeqFrame<_pa_frame_type(nm), 1> _pa_inst_name(nm){};
+#define _pa_seq_next(nm, index) proto_activities::internal::SeqFrame<_pa_frame_type(nm), index> _pa_inst_name(nm);
+#define _pa_seq_activate(inst, call) (proto_activities::internal::seq_activate(inst), call)
+#define _pa_seq_check_trail(alias) \
+    static_assert(!proto_activities::internal::IsSeqFrame<typename std::remove_reference<decltype(pa_this->_pa_inst_name(alias))>::type>::value, \
+                  "frames of pa_use_seq must not run concurrently in pa_co");
+#endif
+
 #define pa_activity_ctx_tm(nm, vars...) pa_activity_ctx(nm, pa_ctx_tm(vars))
 
 #define pa_activity_def(nm, ...) \
-    pa_rc_t nm(_pa_frame_type(nm)* pa_this, pa_time_t pa_current_time_ms, ##__VA_ARGS__) { \
+    _pa_dispatch_attr pa_rc_t nm(_pa_frame_type(nm)* pa_this, pa_time_t pa_current_time_ms, ##__VA_ARGS__) { \
+        _pa_pc_base; \
+        _pa_profile_scope(nm); \
+        _pa_trace_scope(nm); \
         _pa_enter_invoke(_pa_frame_name(nm)); \
-        switch (pa_this->_pa_pc) { \
-            case 0: \
-            case 0xffff:
+        _pa_enter_stay_awake(_pa_frame_name(nm)); \
+        _pa_wake_reset; \
+        _pa_dispatch
 
 #define pa_activity_end \
         } \
@@ -131,25 +421,365 @@ namespace proto_activities { namespace internal {
     _pa_reset(pa_this); \
     return PA_RC_DONE;
 
+/* Profile */
+
+/* Each activity type accumulates its calls, the time spent in it with (inclusive) and without (exclusive) its
+   sub-activities and the maximum time spent in it within one tick - a tick starts with the entry of a top-level
+   activity. The time is measured in units of PA_PROFILE_CLOCK, which defaults to the cycle counter on x86.
+   Profiling is meant for activities ticked from a single thread. */
+
+#ifdef PA_PROFILE
+
+#include <stdio.h> /* for pa_profile_dump */
+
+#ifndef PA_PROFILE_CLOCK
+#if defined(__x86_64__) || defined(__i386__)
+#define PA_PROFILE_CLOCK() __builtin_ia32_rdtsc()
+#else
+#include <time.h> /* for clock_gettime */
+static inline uint64_t _pa_profile_clock(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+#define PA_PROFILE_CLOCK() _pa_profile_clock()
+#endif
+#endif
+
+#ifndef _PA_ENABLE_CPP
+#define _pa_profile_inline static inline
+#else
+#define _pa_profile_inline inline
+#endif
+
+typedef struct pa_profile_s {
+    const char* name;
+    uint64_t calls;
+    uint64_t inclusive;
+    uint64_t exclusive;
+    uint64_t max_tick;
+    uint64_t tick_time;
+    uint64_t tick;
+    struct pa_profile_s* next;
+    bool listed;
+} pa_profile_t;
+
+typedef struct _pa_profile_scope_s {
+    pa_profile_t* profile;
+    uint64_t start;
+    uint64_t children;
+    struct _pa_profile_scope_s* parent;
+} _pa_profile_scope_t;
+
+typedef struct {
+    pa_profile_t* first;
+    _pa_profile_scope_t* current;
+    uint64_t tick;
+} _pa_profile_state_t;
+
+/* In C, one translation unit of the program has to expand PA_PROFILE_DEFINE to hold the profiling state -
+   C++ shares the static of an inline function between all translation units already */
+#ifndef _PA_ENABLE_CPP
+extern _pa_profile_state_t _pa_profile_state_slot;
+#define PA_PROFILE_DEFINE _pa_profile_state_t _pa_profile_state_slot;
+#define _pa_profile_state() (&_pa_profile_state_slot)
+#else
+#define PA_PROFILE_DEFINE
+_pa_profile_inline _pa_profile_state_t* _pa_profile_state(void) {
+    static _pa_profile_state_t state;
+    return &state;
+}
+#endif
+
+_pa_profile_inline void _pa_profile_enter(_pa_profile_scope_t* scope, pa_profile_t* profile) {
+    _pa_profile_state_t* state = _pa_profile_state();
+    if (!profile->listed) {
+        profile->listed = true;
+        profile->next = state->first;
+        state->first = profile;
+    }
+    if (!state->current) {
+        ++state->tick;
+    }
+    ++profile->calls;
+    scope->profile = profile;
+    scope->children = 0;
+    scope->parent = state->current;
+    state->current = scope;
+    scope->start = PA_PROFILE_CLOCK();
+}
+
+_pa_profile_inline void _pa_profile_exit(_pa_profile_scope_t* scope) {
+    const uint64_t elapsed = PA_PROFILE_CLOCK() - scope->start;
+    _pa_profile_state_t* state = _pa_profile_state();
+    pa_profile_t* profile = scope->profile;
+    profile->inclusive += elapsed;
+    profile->exclusive += elapsed - scope->children;
+    if (profile->tick != state->tick) {
+        profile->tick = state->tick;
+        profile->tick_time = 0;
+    }
+    profile->tick_time += elapsed;
+    if (profile->tick_time > profile->max_tick) {
+        profile->max_tick = profile->tick_time;
+    }
+    if (scope->parent) {
+        scope->parent->children += elapsed;
+    }
+    state->current = scope->parent;
+}
+
+/* The exit is recorded by the cleanup of the scope - whichever way the activity returns */
+#define _pa_profile_scope(nm) \
+    static pa_profile_t _pa_profile = {#nm, 0, 0, 0, 0, 0, 0, NULL, false}; \
+    _pa_profile_scope_t _pa_profile_scope __attribute__((cleanup(_pa_profile_exit))); \
+    _pa_profile_enter(&_pa_profile_scope, &_pa_profile)
+
+_pa_profile_inline void _pa_profile_reset(void) {
+    for (pa_profile_t* profile = _pa_profile_state()->first; profile; profile = profile->next) {
+        profile->calls = profile->inclusive = profile->exclusive = profile->max_tick = profile->tick_time = 0;
+    }
+}
+
+_pa_profile_inline void _pa_profile_dump(FILE* out) {
+    fprintf(out, "%-24s %10s %14s %14s %14s\n", "activity", "calls", "inclusive", "exclusive", "max/tick");
+    for (const pa_profile_t* profile = _pa_profile_state()->first; profile; profile = profile->next) {
+        if (profile->calls == 0) {
+            continue;
+        }
+        fprintf(out, "%-24s %10llu %14llu %14llu %14llu\n", profile->name, (unsigned long long)profile->calls,
+                (unsigned long long)profile->inclusive, (unsigned long long)profile->exclusive, (unsigned long long)profile->max_tick);
+    }
+}
+
+/* The profiles of all activities entered so far - follow `next` for the others */
+#define pa_profile_first() ((const pa_profile_t*)_pa_profile_state()->first)
+#define pa_profile_reset() _pa_profile_reset()
+#define pa_profile_dump(out) _pa_profile_dump(out)
+
+#else
+
+#define PA_PROFILE_DEFINE
+#define _pa_profile_scope(nm) (void)0
+#define pa_profile_reset() ((void)0)
+#define pa_profile_dump(out) ((void)0)
+
+#endif
+
+/* Trace */
+
+/* Records the entry and exit of activities, the trails run by pa_co, the checks of pa_await conditions, the aborts
+   by pa_when_abort and the defers run. Each thread records into the ring it attached - once the ring is full, the
+   oldest events get overwritten. An event holds a timestamp, a pointer to a static name and a small argument, so
+   recording never formats or allocates. pa_trace_write_json converts rings into the Chrome trace format, which
+   chrome://tracing and ui.perfetto.dev open. */
+
+#ifdef PA_TRACE
+
+#include <assert.h> /* for pa_trace_init */
+#include <stdio.h> /* for pa_trace_write_json */
+
+#ifndef PA_TRACE_CLOCK
+#include <time.h> /* for clock_gettime */
+static inline uint64_t _pa_trace_clock(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+#define PA_TRACE_CLOCK() _pa_trace_clock() /* in nanoseconds */
+#endif
+
+#ifndef _PA_ENABLE_CPP
+#define _pa_trace_inline static inline
+#define _pa_thread_local _Thread_local
+#else
+#define _pa_trace_inline inline
+#define _pa_thread_local thread_local
+#endif
+
+enum {
+    PA_TRACE_ENTER,
+    PA_TRACE_EXIT,
+    PA_TRACE_TRAIL, /* arg is the index of the trail */
+    PA_TRACE_AWAIT, /* arg is the line of the check shifted by one with the result in the lowest bit */
+    PA_TRACE_ABORT,
+    PA_TRACE_DEFER
+};
+
+typedef struct {
+    uint64_t time;
+    const char* name;
+    uint32_t arg;
+    uint8_t kind;
+} pa_trace_event_t;
+
+typedef struct {
+    pa_trace_event_t* events;
+    uint32_t mask;
+    uint32_t tid;
+    uint64_t count;
+} pa_trace_ring_t;
+
+/* The capacity has to be a power of two */
+_pa_trace_inline void pa_trace_init(pa_trace_ring_t* ring, pa_trace_event_t* events, uint32_t capacity, uint32_t tid) {
+    assert(capacity > 0 && (capacity & (capacity - 1)) == 0);
+    ring->events = events;
+    ring->mask = capacity - 1;
+    ring->tid = tid;
+    ring->count = 0;
+}
+
+/* In C, one translation unit of the program has to expand PA_TRACE_DEFINE to hold the ring of each thread -
+   C++ shares the static of an inline function between all translation units already */
+#ifndef _PA_ENABLE_CPP
+extern _pa_thread_local pa_trace_ring_t* _pa_trace_ring_slot;
+#define PA_TRACE_DEFINE _pa_thread_local pa_trace_ring_t* _pa_trace_ring_slot = NULL;
+#define _pa_trace_ring() (&_pa_trace_ring_slot)
+#else
+#define PA_TRACE_DEFINE
+_pa_trace_inline pa_trace_ring_t** _pa_trace_ring(void) {
+    static _pa_thread_local pa_trace_ring_t* ring;
+    return &ring;
+}
+#endif
+
+_pa_trace_inline void _pa_trace_record(uint8_t kind, const char* name, uint32_t arg) {
+    pa_trace_ring_t* ring = *_pa_trace_ring();
+    if (ring) {
+        pa_trace_event_t* event = &ring->events[ring->count++ & ring->mask];
+        event->time = PA_TRACE_CLOCK();
+        event->name = name;
+        event->arg = arg;
+        event->kind = kind;
+    }
+}
+
+_pa_trace_inline void _pa_trace_exit(const char** name) {
+    _pa_trace_record(PA_TRACE_EXIT, *name, 0);
+}
+
+_pa_trace_inline bool _pa_trace_check(uint32_t line, bool result) {
+    _pa_trace_record(PA_TRACE_AWAIT, "await", line << 1 | result);
+    return result;
+}
+
+#define _pa_trace_scope(nm) \
+    const char* _pa_trace_name __attribute__((cleanup(_pa_trace_exit))) = #nm; \
+    _pa_trace_record(PA_TRACE_ENTER, _pa_trace_name, 0)
+#define _pa_trace_event(kind, name, arg) _pa_trace_record(kind, name, arg);
+
+_pa_trace_inline void _pa_trace_write_json(FILE* out, pa_trace_ring_t* const* rings, size_t n) {
+    const char* sep = "";
+    fprintf(out, "{\"traceEvents\":[");
+    for (size_t r = 0; r < n; ++r) {
+        const pa_trace_ring_t* ring = rings[r];
+        const uint64_t capacity = (uint64_t)ring->mask + 1;
+        for (uint64_t i = ring->count > capacity ? ring->count - capacity : 0; i < ring->count; ++i) {
+            const pa_trace_event_t* event = &ring->events[i & ring->mask];
+            fprintf(out, "%s\n{\"name\":\"%s\",\"ts\":%.3f,\"pid\":1,\"tid\":%u,", sep, event->name, event->time / 1000.0, ring->tid);
+            switch (event->kind) {
+                case PA_TRACE_ENTER: fprintf(out, "\"ph\":\"B\"}"); break;
+                case PA_TRACE_EXIT: fprintf(out, "\"ph\":\"E\"}"); break;
+                case PA_TRACE_TRAIL: fprintf(out, "\"ph\":\"i\",\"s\":\"t\",\"cat\":\"trail\",\"args\":{\"trail\":%u}}", event->arg); break;
+                case PA_TRACE_AWAIT: fprintf(out, "\"ph\":\"i\",\"s\":\"t\",\"args\":{\"line\":%u,\"result\":%s}}", event->arg >> 1, (event->arg & 1) ? "true" : "false"); break;
+                case PA_TRACE_ABORT: fprintf(out, "\"ph\":\"i\",\"s\":\"t\",\"cat\":\"abort\"}"); break;
+                default: fprintf(out, "\"ph\":\"i\",\"s\":\"t\"}"); break;
+            }
+            sep = ",";
+        }
+    }
+    fprintf(out, "\n]}\n");
+}
+
+/* Makes the calling thread record into `ring` - or stop recording if NULL */
+#define pa_trace_attach(ring) (*_pa_trace_ring() = (ring))
+#define pa_trace_write_json(out, rings, n) _pa_trace_write_json(out, rings, n)
+
+#else
+
+#define PA_TRACE_DEFINE
+#define _pa_trace_scope(nm) (void)0
+#define _pa_trace_event(kind, name, arg)
+#define _pa_trace_check(line, result) (result)
+#define pa_trace_attach(ring) ((void)0)
+#define pa_trace_write_json(out, rings, n) ((void)0)
+
+#endif
+
+/* Dispatch */
+
+/* Resume points are numbered densely per activity, so the switch compiles to a jump table */
+#ifdef __COUNTER__
+#define _pa_pc_base enum { _pa_pc_first = __COUNTER__ }
+#define _pa_mark_and_wait_n(n) _pa_mark_and_wait((n - _pa_pc_first), _pa_concat(_pa_pc_, n))
+#define _pa_mark_and_continue_n(n) _pa_mark_and_continue((n - _pa_pc_first), _pa_concat(_pa_pc_, n))
+#define _pa_mark_and_wait_next _pa_mark_and_wait_n(__COUNTER__)
+#define _pa_mark_and_wait2_next _pa_mark_and_wait_n(__COUNTER__)
+#define _pa_mark_and_continue_next _pa_mark_and_continue_n(__COUNTER__)
+#else
+#define _pa_pc_base
+#define _pa_mark_and_wait_next _pa_mark_and_wait(__LINE__, _pa_concat(_pa_pc_, __LINE__))
+#define _pa_mark_and_wait2_next _pa_mark_and_wait(__LINE__ | 0x8000, _pa_concat(_pa_pc2_, __LINE__))
+#define _pa_mark_and_continue_next _pa_mark_and_continue(__LINE__, _pa_concat(_pa_pc_, __LINE__))
+#endif
+
+#define _pa_mark_and_wait(pc, label) _pa_mark(pc, label) pa_wait; _pa_label(pc, label)
+#define _pa_mark_and_continue(pc, label) _pa_mark(pc, label) _pa_label(pc, label)
+
+#ifndef PA_USE_COMPUTED_GOTO
+#define _pa_dispatch \
+        switch (pa_this->_pa_pc) { \
+            case 0: \
+            case _PA_PC_ABORT:
+#define _pa_pc_check(pc) (void)sizeof(char[(pc) < _PA_PC_ABORT ? 1 : -1]); /* too many resume points for pa_pc_t */
+#define _pa_mark(pc, label) _pa_pc_check(pc) pa_this->_pa_pc = pc;
+#define _pa_label(pc, label) case pc:
+#define _pa_dispatch_attr
+#else
+/* Label addresses are only stable within one copy of an activity. Compilers never inline a function with a
+   computed goto, but GCC might still clone it for constant arguments. */
+#ifdef __clang__
+#define _pa_dispatch_attr
+#else
+#define _pa_dispatch_attr __attribute__((noclone))
+#endif
+#define _pa_dispatch \
+        if (pa_this->_pa_pc != 0 && pa_this->_pa_pc != _PA_PC_ABORT) { \
+            goto *(void*)pa_this->_pa_pc; \
+        } \
+        {
+/* GCC mistakes the address of a label for the one of a local variable and warns about it outliving the call */
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 12
+#define _pa_mark(pc, label) \
+    _Pragma("GCC diagnostic push") \
+    _Pragma("GCC diagnostic ignored \"-Wdangling-pointer\"") \
+    pa_this->_pa_pc = &&label; \
+    _Pragma("GCC diagnostic pop")
+#else
+#define _pa_mark(pc, label) pa_this->_pa_pc = &&label;
+#endif
+#define _pa_label(pc, label) label:
+#endif
+
 /* Expert API */
 
 #define pa_wait \
     return PA_RC_WAIT;
 
 #define pa_mark_and_wait \
-    pa_this->_pa_pc = __LINE__; pa_wait; case __LINE__:
+    _pa_mark_and_wait_next
 
 #define pa_mark_and_wait2 \
-    pa_this->_pa_pc = __LINE__ | 0x8000; pa_wait; case __LINE__ | 0x8000:
+    _pa_mark_and_wait2_next
 
 #define pa_mark_and_continue \
-    pa_this->_pa_pc = __LINE__; case __LINE__:
+    _pa_mark_and_continue_next
 
 /* Await */
 
 #define pa_await(cond) \
     pa_mark_and_wait; \
-    if (!(cond)) { \
+    if (!_pa_trace_check(__LINE__, _pa_wake_cond(cond))) { \
         pa_wait; \
     }
 
@@ -162,145 +792,320 @@ namespace proto_activities { namespace internal {
         pa_wait; \
     }
 
-#define pa_delay_ms(ms) \
+#define _pa_delay_ms_templ(ms, fixed) \
     pa_self._pa_time = pa_current_time_ms; \
     pa_mark_and_continue; \
     if (pa_current_time_ms - pa_self._pa_time < ms) { \
+        _pa_wake_at_ms(pa_self._pa_time, ms, fixed); \
         pa_wait; \
     }
 
+#define pa_delay_ms(ms) _pa_delay_ms_templ(ms, false)
 #define pa_delay_s(s) pa_delay_ms(s * 1000)
 
+/* Like pa_delay_ms but for a duration which never changes while waiting - it sleeps with wake sets */
+#define pa_delay_ms_const(ms) _pa_delay_ms_templ(ms, true)
+#define pa_delay_s_const(s) pa_delay_ms_const(s * 1000)
+
 /* Run */
 
 #define pa_run(nm, ...) \
     pa_mark_and_continue; \
     if (_pa_call(nm, ##__VA_ARGS__) == PA_RC_WAIT) { \
+        _pa_wake_from(_pa_inst_ptr(nm)); \
         pa_wait; \
     }
 
 #define pa_run_as(nm, alias, ...) \
     pa_mark_and_continue; \
     if (_pa_call_as(nm, alias, ##__VA_ARGS__) == PA_RC_WAIT) { \
+        _pa_wake_from(_pa_inst_ptr(alias)); \
         pa_wait; \
     }
 
 /* Concurrency */
 
-#define pa_co_res(n) \
-    pa_rc_t _pa_co_rcs[n];
+/* A trail only ever waits or is done, so its state is a single bit in the words of `_pa_co_waits`.
+   The words are bytes to keep the alignment of frames - a section of up to 8 trails costs a single byte. */
+typedef uint8_t pa_co_word_t;
+
+#define _PA_CO_WORD_BITS 8
+#define _pa_co_words(n) (((n) + _PA_CO_WORD_BITS - 1) / _PA_CO_WORD_BITS)
 
 #ifndef _PA_ENABLE_CPP
+#define _pa_co_check(n) _Static_assert((n) <= 65535, "a section holds up to 65535 trails")
+#else
+#define _pa_co_check(n) static_assert((n) <= 65535, "a section holds up to 65535 trails")
+#endif
 
-#define _pa_co_def(n) \
-    struct { \
-        void* addrs[n]; \
-        size_t szs[n]; \
-    } _pa_co;
+/* `_pa_co_ended` counts the strong trails which have ended - so a tick only updates it when a trail changes state */
+#define pa_co_res(n) \
+    _pa_co_check(n); \
+    pa_co_word_t _pa_co_waits[_pa_co_words(n)]; \
+    uint16_t _pa_co_ended;
+
+#define _pa_co_word(i) pa_this->_pa_co_waits[(i) / _PA_CO_WORD_BITS]
+#define _pa_co_bit(i) ((pa_co_word_t)(1u << ((i) % _PA_CO_WORD_BITS)))
+#define _pa_co_is_waiting(i) ((_pa_co_word(i) & _pa_co_bit(i)) != 0)
 
-#define _pa_co_clr(i) _pa_co.addrs[i] = NULL;
+/* A section ends once all of its strong trails - or if it has none, any of its weak trails - have ended.
+   The number of strong trails is counted by straight-line code, so the compiler folds it into a constant.
+   Weak trails which run without ending are noted in a table on the stack - to be aborted if the section ends.
+   Weak trails which have ended need no reset, as an activity resets its frame when it returns. */
 
-#define _pa_co_set(i, obj, nm) \
-    _pa_co.addrs[i] = obj; \
-    _pa_co.szs[i] = sizeof(_pa_frame_type(nm));
+#ifndef _PA_ENABLE_CPP
 
-#define _pa_co_is_strong(i) (_pa_co.addrs[i] == NULL)
+typedef struct {
+    void* frame;
+    size_t size;
+    uint16_t trail;
+} _pa_co_weak_t;
+
+#define _pa_co_weak_note(obj, nm) { \
+            _pa_co_weak_t* _pa_weak = &_pa_co_weak[_pa_co_nweak++]; \
+            _pa_weak->frame = obj; \
+            _pa_weak->size = sizeof(_pa_frame_type(nm)); \
+            _pa_weak->trail = _pa_co_i; \
+        }
 
-#define _pa_co_reset(i) memset(_pa_co.addrs[i], 0, _pa_co.szs[i]);
+#define _pa_co_weak_abort(weak) \
+    memset((weak).frame, 0, (weak).size); \
+    *(pa_pc_t*)(weak).frame = _PA_PC_ABORT;
 
-#define _pa_co_abort(i) \
-    _pa_co_reset(i); \
-    *(pa_pc_t*)(_pa_co.addrs[i]) = 0xffff;
+#define _pa_par_def(n)
+#define _pa_co_join
 
 #else
 
-#define _pa_co_def(n) \
-    proto_activities::internal::AnyFrame* _pa_co[n];
+namespace proto_activities { namespace internal {
+    struct WeakTrail {
+        AnyFrame* frame;
+        void (*abort)(AnyFrame* frame);
+        uint16_t trail;
+    };
 
-#define _pa_co_clr(i) _pa_co[i] = nullptr;
+    template <typename T>
+    void abort_frame(AnyFrame* frame) {
+        static_cast<T*>(frame)->reset();
+        frame->_pa_pc = _PA_PC_ABORT;
+    }
 
-#define _pa_co_set(i, obj, nm) _pa_co[i] = obj;
+    template <typename T>
+    WeakTrail weak_trail(T* frame, uint16_t trail) {
+        return {frame, &abort_frame<T>, trail};
+    }
+} }
 
-#define _pa_co_is_strong(i) (_pa_co[i] == nullptr)
+#define _pa_co_weak_t proto_activities::internal::WeakTrail
+#define _pa_co_weak_note(obj, nm) _pa_co_weak[_pa_co_nweak++] = proto_activities::internal::weak_trail(obj, _pa_co_i);
+#define _pa_co_weak_abort(weak) (weak).abort((weak).frame);
 
-#define _pa_co_reset(i) _pa_reset(_pa_co[i]);
+namespace proto_activities { namespace internal {
+    /* Trails of a plain `pa_co` run sequentially - see `pa_co_par` for parallel ones */
+    struct NoParGroup {
+        void join() {}
+#ifdef PA_USE_WAKE_SETS
+        void join(pa_wake_t&) {}
+#endif
+        void count(pa_co_word_t*, uint16_t&, bool&) {}
+    };
+} }
 
-#define _pa_co_abort(i) _pa_abort(_pa_co[i]);
+#define _pa_par_def(n) proto_activities::internal::NoParGroup _pa_par;
+#ifdef PA_USE_WAKE_SETS
+#define _pa_co_join \
+    _pa_par.join(_pa_co_wake); \
+    _pa_par.count(pa_this->_pa_co_waits, pa_this->_pa_co_ended, _pa_co_any_done);
+#else
+#define _pa_co_join \
+    _pa_par.join(); \
+    _pa_par.count(pa_this->_pa_co_waits, pa_this->_pa_co_ended, _pa_co_any_done);
+#endif
 
 #endif
 
-#define pa_co(n) \
-    memset(pa_this->_pa_co_rcs, -1, sizeof(pa_rc_t) * n); \
+#define _pa_co_templ(n, par_def) \
+    memset(pa_this->_pa_co_waits, 0xff, sizeof(pa_co_word_t) * _pa_co_words(n)); \
+    pa_this->_pa_co_ended = 0; \
     pa_mark_and_continue; \
     { \
-        uint8_t _pa_co_i = 0; \
-        _pa_co_def(n);
+        uint16_t _pa_co_i = 0; \
+        uint16_t _pa_co_strong = 0; \
+        uint16_t _pa_co_nweak = 0; \
+        bool _pa_co_any_done = false; \
+        _pa_co_weak_t _pa_co_weak[n]; \
+        _pa_co_wake_def; \
+        par_def
+
+#define pa_co(n) _pa_co_templ(n, _pa_par_def(n))
+
+#define _pa_with_run(alias, call, on_wait, on_end) \
+        if (_pa_co_is_waiting(_pa_co_i)) { \
+            _pa_trace_event(PA_TRACE_TRAIL, #alias, _pa_co_i) \
+            if (call == PA_RC_WAIT) { \
+                _pa_co_wake_join(_pa_inst_ptr(alias)); \
+                on_wait \
+            } else { \
+                _pa_co_word(_pa_co_i) &= ~_pa_co_bit(_pa_co_i); \
+                _pa_co_any_done = true; \
+                on_end \
+            } \
+        }
 
-#define _pa_with_templ(nm, call) \
-        if (pa_this->_pa_co_rcs[_pa_co_i] == PA_RC_WAIT) { \
-            pa_this->_pa_co_rcs[_pa_co_i] = call; \
-        } \
-        _pa_co_clr(_pa_co_i); \
+#define _pa_with_templ(nm, alias, call) \
+        _pa_seq_check_trail(alias); \
+        _pa_with_run(alias, call, , ++pa_this->_pa_co_ended;); \
+        ++_pa_co_strong; \
         ++_pa_co_i;
 
 #define _pa_with_weak_templ(nm, alias, call) \
-        if (pa_this->_pa_co_rcs[_pa_co_i] == PA_RC_WAIT) { \
-            pa_this->_pa_co_rcs[_pa_co_i] = call; \
-        } \
-        _pa_co_set(_pa_co_i, _pa_inst_ptr(alias), nm); \
+        _pa_seq_check_trail(alias); \
+        _pa_with_run(alias, call, _pa_co_weak_note(_pa_inst_ptr(alias), nm), ); \
         ++_pa_co_i;
 
-#define pa_with(nm, ...) _pa_with_templ(nm, _pa_call(nm, ##__VA_ARGS__));
-#define pa_with_as(nm, alias, ...) _pa_with_templ(nm, _pa_call_as(nm, alias, ##__VA_ARGS__));
+#define pa_with(nm, ...) _pa_with_templ(nm, nm, _pa_call(nm, ##__VA_ARGS__));
+#define pa_with_as(nm, alias, ...) _pa_with_templ(nm, alias, _pa_call_as(nm, alias, ##__VA_ARGS__));
 
 #define pa_with_weak(nm, ...) _pa_with_weak_templ(nm, nm, _pa_call(nm, ##__VA_ARGS__));
 #define pa_with_weak_as(nm, alias, ...) _pa_with_weak_templ(nm, alias, _pa_call_as(nm, alias, ##__VA_ARGS__));
 
 #define pa_co_end \
-        { \
-            bool _pa_any_is_strong = false; \
-            bool _pa_any_is_done = false; \
-            for (uint8_t i = 0; i < _pa_co_i; ++i) { \
-                bool _pa_is_strong = _pa_co_is_strong(i); \
-                bool _pa_is_waiting = pa_this->_pa_co_rcs[i] == PA_RC_WAIT; \
-                if (_pa_is_strong && _pa_is_waiting) { \
-                    pa_wait; \
-                } \
-                _pa_any_is_strong |= _pa_is_strong; \
-                _pa_any_is_done |= !_pa_is_waiting; \
-            } \
-            if (!_pa_any_is_strong && !_pa_any_is_done) { \
-                pa_wait; \
+        _pa_co_join; \
+        if (!_pa_co_any_done || pa_this->_pa_co_ended < _pa_co_strong) { \
+            _pa_co_wake_apply; \
+            pa_wait; \
+        } \
+        for (uint16_t k = 0; k < _pa_co_nweak; ++k) { \
+            if (_pa_co_is_waiting(_pa_co_weak[k].trail)) { \
+                _pa_co_weak_abort(_pa_co_weak[k]); \
             } \
         } \
-        for (uint8_t i = 0; i < _pa_co_i; ++i) { \
-            if (!_pa_co_is_strong(i)) { \
-                if (pa_this->_pa_co_rcs[i] == PA_RC_WAIT) { \
-                    _pa_co_abort(i); \
-                } \
-                else { \
-                    _pa_co_reset(i); \
-                } \
+    }
+
+/* Dynamic Trails */
+
+/* A set of up to 65535 trails of the same activity, which can be added and removed while the others keep running.
+   The slots of the running trails are kept densely at the front of `slots`, so ticking a set is O(running trails).
+   Free frames are always reset, so adding a trail is O(1) - as is removing one, which aborts it. */
+
+#define _pa_each_name(nm) nm##_each
+#define _pa_each_capacity(set) (sizeof((set).slots) / sizeof(uint16_t))
+
+#ifndef _PA_ENABLE_CPP
+#define _pa_each_check(n) _Static_assert((n) <= 65535, "a set holds up to 65535 trails")
+#else
+#define _pa_each_check(n) static_assert((n) <= 65535, "a set holds up to 65535 trails")
+#endif
+
+#define _pa_each_def(ty, nm, n) \
+    struct { \
+        _pa_each_check(n); \
+        uint16_t count; \
+        uint16_t fresh; \
+        uint16_t slots[n]; \
+        uint16_t where[n]; \
+        _pa_frame_type(ty) frames[n]; \
+    } _pa_each_name(nm)
+
+#ifndef _PA_ENABLE_CPP
+#define pa_use_each(nm, n) _pa_each_def(nm, nm, n);
+#else
+#define pa_use_each(nm, n) _pa_each_def(nm, nm, n){};
+#define pa_use_each_ns(ns, nm, n) _pa_each_def(ns::nm, nm, n){};
+#endif
+
+/* Slots below `fresh` have been used before - the free ones among them follow the running ones in `slots` */
+static inline int32_t _pa_each_add(uint16_t* count, uint16_t* fresh, uint16_t* slots, uint16_t* where, size_t capacity) {
+    if (*count == capacity) {
+        return -1;
+    }
+    if (*count == *fresh) {
+        slots[*count] = *fresh;
+        where[*fresh] = *count;
+        ++*fresh;
+    }
+    return slots[(*count)++];
+}
+
+static inline void _pa_each_release(uint16_t* count, uint16_t* slots, uint16_t* where, uint16_t pos) {
+    const uint16_t last = --*count;
+    const uint16_t slot = slots[pos];
+    slots[pos] = slots[last];
+    where[slots[last]] = pos;
+    slots[last] = slot;
+    where[slot] = last;
+}
+
+#define _pa_each_set(nm) pa_self._pa_each_name(nm)
+/* A negative slot - as returned by an add to a full set - wraps above any valid one */
+#define _pa_each_is_running(set, slot) ((uint32_t)(slot) < (set).fresh && (set).where[slot] < (set).count)
+
+#define _pa_each_templ(nm, wait, ...) \
+    { \
+        _pa_co_wake_def; \
+        for (uint16_t _pa_each_k = 0; _pa_each_k < _pa_each_set(nm).count;) { \
+            const uint16_t pa_each_i = _pa_each_set(nm).slots[_pa_each_k]; \
+            if (_pa_wake_guard(&_pa_each_set(nm).frames[pa_each_i], pa_current_time_ms, \
+                               nm(&_pa_each_set(nm).frames[pa_each_i], pa_current_time_ms, ##__VA_ARGS__)) == PA_RC_WAIT) { \
+                _pa_co_wake_join(&_pa_each_set(nm).frames[pa_each_i]); \
+                ++_pa_each_k; \
+            } else { \
+                _pa_each_release(&_pa_each_set(nm).count, _pa_each_set(nm).slots, _pa_each_set(nm).where, _pa_each_k); \
             } \
         } \
+        wait \
     }
 
+/* Starts a new trail in the set of `nm` - returns its slot or -1 if the set is full */
+#define pa_each_add(nm) \
+    _pa_each_add(&_pa_each_set(nm).count, &_pa_each_set(nm).fresh, _pa_each_set(nm).slots, _pa_each_set(nm).where, \
+                 _pa_each_capacity(_pa_each_set(nm)))
+
+/* Aborts the trail in `slot` unless it has already ended - does nothing for the -1 of an add to a full set */
+#define pa_each_remove(nm, slot) \
+    if (_pa_each_is_running(_pa_each_set(nm), slot)) { \
+        _pa_abort(&_pa_each_set(nm).frames[slot]); \
+        _pa_each_release(&_pa_each_set(nm).count, _pa_each_set(nm).slots, _pa_each_set(nm).where, \
+                         _pa_each_set(nm).where[slot]); \
+    }
+
+#define pa_each_count(nm) (_pa_each_set(nm).count)
+#define pa_each_is_running(nm, slot) _pa_each_is_running(_pa_each_set(nm), slot)
+#define pa_each_frame(nm, slot) (&_pa_each_set(nm).frames[slot])
+
+/* Runs all trails of the set once - the slot of the trail being run is available as `pa_each_i` in the arguments */
+#define pa_tick_each(nm, ...) _pa_each_templ(nm, , ##__VA_ARGS__)
+
+/* Runs all trails of the set until none is left - trails may be added and removed in between */
+#define pa_co_each(nm, ...) \
+    pa_mark_and_continue; \
+    _pa_each_templ(nm, \
+        if (pa_each_count(nm) > 0) { \
+            _pa_co_wake_apply; \
+            pa_wait; \
+        }, ##__VA_ARGS__)
+
 /* Preemption */
 
-#define pa_did_abort(nm) (*_pa_inst_ptr(nm)._pa_pc == 0xffff)
+#define pa_did_abort(nm) (*_pa_inst_ptr(nm)._pa_pc == _PA_PC_ABORT)
 
-#define _pa_when_abort_templ(cond, nm, alias, call) \
+#define _pa_when_abort_wake_templ(cond, wake, nm, alias, call) \
     if (call == PA_RC_WAIT) { \
+        wake; \
         pa_mark_and_wait; \
         if (!(cond)) { \
             if (call == PA_RC_WAIT) { \
+                wake; \
                 pa_wait; \
             } \
         } else { \
+            _pa_trace_event(PA_TRACE_ABORT, #alias, 0) \
             _pa_abort(_pa_inst_ptr(alias)); \
         } \
     }
 
+#define _pa_when_abort_templ(cond, nm, alias, call) _pa_when_abort_wake_templ(cond, , nm, alias, call)
+
 #define pa_when_abort(cond, nm, ...) _pa_when_abort_templ(cond, nm, nm, _pa_call(nm, ##__VA_ARGS__))
 #define pa_when_abort_as(cond, nm, alias, ...) _pa_when_abort_templ(cond, nm, alias, _pa_call_as(nm, alias, ##__VA_ARGS__))
 
@@ -346,16 +1151,24 @@ namespace proto_activities { namespace internal {
 #define pa_after_abort(ticks, nm, ...) _pa_after_abort_templ(ticks, nm, nm, _pa_call(nm, ##__VA_ARGS__))
 #define pa_after_abort_as(ticks, nm, alias, ...) _pa_after_abort_templ(ticks, nm, alias, _pa_call_as(nm, alias, ##__VA_ARGS__))
 
-#define _pa_after_ms_abort_templ(ms, nm, alias, call) \
+#define _pa_after_ms_abort_templ(ms, fixed, nm, alias, call) \
     pa_self._pa_time = pa_current_time_ms; \
-    _pa_when_abort_templ(pa_current_time_ms - pa_self._pa_time >= ms, nm, alias, call);
+    _pa_when_abort_wake_templ(pa_current_time_ms - pa_self._pa_time >= ms, \
+                              _pa_wake_from_at_ms(_pa_inst_ptr(alias), pa_self._pa_time, ms, fixed), nm, alias, call);
 
-#define pa_after_ms_abort(ms, nm, ...) _pa_after_ms_abort_templ(ms, nm, nm, _pa_call(nm, ##__VA_ARGS__))
-#define pa_after_ms_abort_as(ms, nm, alias, ...) _pa_after_ms_abort_templ(ms, nm, alias, _pa_call_as(nm, alias, ##__VA_ARGS__))
+#define pa_after_ms_abort(ms, nm, ...) _pa_after_ms_abort_templ(ms, false, nm, nm, _pa_call(nm, ##__VA_ARGS__))
+#define pa_after_ms_abort_as(ms, nm, alias, ...) _pa_after_ms_abort_templ(ms, false, nm, alias, _pa_call_as(nm, alias, ##__VA_ARGS__))
 
 #define pa_after_s_abort(s, nm, ...) pa_after_ms_abort(s * 1000, nm, ##__VA_ARGS__)
 #define pa_after_s_abort_as(s, nm, alias, ...) pa_after_ms_abort_as(s * 1000, nm, alias, ##__VA_ARGS__)
 
+/* Like pa_after_ms_abort but for a duration which never changes while waiting - it sleeps with wake sets */
+#define pa_after_ms_abort_const(ms, nm, ...) _pa_after_ms_abort_templ(ms, true, nm, nm, _pa_call(nm, ##__VA_ARGS__))
+#define pa_after_ms_abort_const_as(ms, nm, alias, ...) _pa_after_ms_abort_templ(ms, true, nm, alias, _pa_call_as(nm, alias, ##__VA_ARGS__))
+
+#define pa_after_s_abort_const(s, nm, ...) pa_after_ms_abort_const(s * 1000, nm, ##__VA_ARGS__)
+#define pa_after_s_abort_const_as(s, nm, alias, ...) pa_after_ms_abort_const_as(s * 1000, nm, alias, ##__VA_ARGS__)
+
 /* Lifecycle */
 
 #ifndef _PA_ENABLE_CPP
@@ -363,15 +1176,113 @@ namespace proto_activities { namespace internal {
 #define _pa_susres_suspend(nm, alias)
 #define _pa_susres_resume(nm, alias)
 #define _pa_enter_invoke(ty)
+#define _pa_enter_stay_awake(ty)
 
 #else
 
+/* #define PA_THUNK_CAPACITY to change the bytes available for captures of `pa_defer`, `pa_enter`, `pa_suspend` and `pa_resume` */
+#ifndef PA_THUNK_CAPACITY
+#define PA_THUNK_CAPACITY (4 * sizeof(void*))
+#endif
+
 namespace proto_activities { namespace internal {
-    using Thunk = std::function<void()>;
+    /* A callback which stores its captures inline and so never allocates */
+    class Thunk {
+    public:
+        Thunk() = default;
+        Thunk(std::nullptr_t) {}
+        template <typename F, typename = typename std::enable_if<!std::is_same<typename std::decay<F>::type, Thunk>::value>::type>
+        Thunk(F&& fn) {
+            assign(std::forward<F>(fn));
+        }
+        Thunk(Thunk&& other) {
+            take(other);
+        }
+        Thunk(const Thunk&) = delete;
+        ~Thunk() {
+            reset();
+        }
+
+        Thunk& operator=(Thunk&& other) {
+            if (this != &other) {
+                reset();
+                take(other);
+            }
+            return *this;
+        }
+        Thunk& operator=(std::nullptr_t) {
+            reset();
+            return *this;
+        }
+        template <typename F, typename = typename std::enable_if<!std::is_same<typename std::decay<F>::type, Thunk>::value>::type>
+        Thunk& operator=(F&& fn) {
+            reset();
+            assign(std::forward<F>(fn));
+            return *this;
+        }
+
+        explicit operator bool() const {
+            return ops_ != nullptr;
+        }
+        void operator()() {
+            ops_->invoke(storage_);
+        }
+
+    private:
+        struct Ops {
+            void (*invoke)(void* fn);
+            void (*move)(void* dst, void* src);
+            void (*destroy)(void* fn);
+        };
+
+        template <typename F>
+        struct OpsOf {
+            static void invoke(void* fn) {
+                (*static_cast<F*>(fn))();
+            }
+            static void move(void* dst, void* src) {
+                new (dst) F(std::move(*static_cast<F*>(src)));
+                static_cast<F*>(src)->~F();
+            }
+            static void destroy(void* fn) {
+                static_cast<F*>(fn)->~F();
+            }
+            static const Ops* get() {
+                static const Ops ops{&invoke, &move, &destroy};
+                return &ops;
+            }
+        };
+
+        template <typename F>
+        void assign(F&& fn) {
+            using Fn = typename std::decay<F>::type;
+            static_assert(sizeof(Fn) <= PA_THUNK_CAPACITY, "captures exceed PA_THUNK_CAPACITY");
+            static_assert(alignof(Fn) <= alignof(void*), "captures must not be aligned stricter than a pointer");
+            new (storage_) Fn(std::forward<F>(fn));
+            ops_ = OpsOf<Fn>::get();
+        }
+        void take(Thunk& other) {
+            if (other.ops_) {
+                other.ops_->move(storage_, other.storage_);
+                ops_ = other.ops_;
+                other.ops_ = nullptr;
+            }
+        }
+        void reset() {
+            if (ops_) {
+                ops_->destroy(storage_);
+                ops_ = nullptr;
+            }
+        }
+
+        const Ops* ops_{};
+        alignas(void*) unsigned char storage_[PA_THUNK_CAPACITY];
+    };
 
     struct Defer {
         Defer& operator=(const Defer& other) {
             if (thunk) {
+                _pa_trace_event(PA_TRACE_DEFER, "defer", 0)
                 thunk();
                 thunk = nullptr;
             }
@@ -410,14 +1321,10 @@ namespace proto_activities { namespace internal {
         bool did_suspend{};
     };
 
-    struct Updatable {
-        virtual ~Updatable() = default;
-        virtual void update() = 0;
-        Updatable* next{};
-    };
-
-    struct Enter {
+    /* Also counts the entries for signals - so an activity with `pa_enter_res` needs no `pa_signal_res` */
+    struct Enter : Epoch {
         Enter& operator=(const Enter& other) {
+            Epoch::operator=(other);
             thunk = nullptr;
             return *this;
         }
@@ -426,20 +1333,13 @@ namespace proto_activities { namespace internal {
             thunk();
             return *this;
         }
-        void add(Updatable* updatable) {
-            updatable->next = head;
-            head = updatable;
-        }
         void invoke() {
-            for (auto* updatable = head; updatable != nullptr; updatable = updatable->next) {
-                updatable->update();
-            }
+            Epoch::invoke();
             if (thunk) {
                 thunk();
             }
         }
         Thunk thunk;
-        Updatable* head{};
     };
 } }
 
@@ -490,6 +1390,28 @@ namespace proto_activities { namespace internal {
 #define _pa_enter_invoke(ty) proto_activities::internal::invoke_enter<ty>(pa_self);
 #endif
 
+#ifdef PA_USE_WAKE_SETS
+namespace proto_activities { namespace internal {
+    /* A skipped activity is not entered - so one with `pa_enter_res` and all its callers stay awake */
+    template <typename T, typename = void>
+    struct StayAwake {
+        explicit StayAwake(T*) {}
+    };
+    template <typename T>
+    struct StayAwake<T, typename std::enable_if<std::is_same<decltype(T::_pa_enter), Enter>::value>::type> {
+        explicit StayAwake(T* frame) : frame_(frame) {}
+        ~StayAwake() {
+            frame_->_pa_wake.mode = _PA_WAKE_ANY;
+        }
+    private:
+        T* frame_;
+    };
+} }
+#define _pa_enter_stay_awake(ty) proto_activities::internal::StayAwake<ty> _pa_stay_awake{pa_this};
+#else
+#define _pa_enter_stay_awake(ty)
+#endif
+
 #define pa_enter_res proto_activities::internal::Enter _pa_enter{};
 #define pa_enter pa_self._pa_enter = [&]()
 
@@ -499,93 +1421,702 @@ namespace proto_activities { namespace internal {
 
 #ifdef _PA_ENABLE_CPP
 
-namespace proto_activities {
-    struct Signal final : internal::Updatable {
-        Signal(internal::Enter& enter) {
-            enter.add(this);
+namespace proto_activities { namespace internal {
+    /* Uninitialized room for the value of a signal - it is constructed on the first emit only */
+    template <typename T, bool = std::is_trivially_destructible<T>::value>
+    struct ValStorage {
+        alignas(T) unsigned char bytes[sizeof(T)];
+        bool constructed{};
+
+        T& get() {
+            return *reinterpret_cast<T*>(bytes);
         }
-        Signal(const Signal&) = delete;
-        Signal& operator=(const Signal&) {
-            is_present_ = false;
-            return *this;
+        const T& get() const {
+            return *reinterpret_cast<const T*>(bytes);
+        }
+        template <typename... Args>
+        void construct(Args&&... args) {
+            ::new (static_cast<void*>(bytes)) T(std::forward<Args>(args)...);
+            constructed = true;
+        }
+        void destroy() {
+            if (constructed) {
+                get().~T();
+                constructed = false;
+            }
+        }
+    };
+    template <typename T>
+    struct ValStorage<T, false> : ValStorage<T, true> {
+        ValStorage() = default;
+        ValStorage(const ValStorage&) = delete;
+        ValStorage& operator=(const ValStorage&) = delete;
+        ~ValStorage() {
+            this->destroy();
+        }
+    };
+} }
+
+namespace proto_activities {
+    struct Signal final : internal::Presence {
+        Signal(internal::Epoch& epoch) : Presence(epoch) {
         }
         void emit() {
-            is_present_ = true;
+            mark();
         }
         operator bool() const {
-            return is_present_;
+            return is_present();
         }
-        void update() final {
-            is_present_ = false;
+        const internal::Presence* presence() const {
+            return this;
         }
-    private:
-        bool is_present_{};
     };
 
     template <typename T>
-    struct ValSignal final : internal::Updatable {
-        ValSignal(internal::Enter& enter) {
-            enter.add(this);
-        }
-        ValSignal(const ValSignal&) = delete;
-        ValSignal& operator=(const ValSignal&) {
-            is_present_ = false;
-            has_emitted_val_ = false;
-            value_ = {};
+    struct ValSignal final : internal::Presence {
+        using value_type = T;
+
+        ValSignal(internal::Epoch& epoch) : Presence(epoch) {
+        }
+        /* A reset only destroys a value which was emitted - the storage stays untouched otherwise */
+        ValSignal& operator=(const ValSignal& other) {
+            Presence::operator=(other);
+            storage_.destroy();
             return *this;
         }
+        void emit(const T& val) {
+            assign(val);
+        }
         void emit(T&& val) {
-            is_present_ = true;
-            has_emitted_val_ = true;
-            value_ = std::move(val);
+            assign(std::move(val));
+        }
+        /* Emits anything the value can be assigned from - like a view onto a payload living elsewhere */
+        template <typename U, typename = typename std::enable_if<!std::is_same<typename std::decay<U>::type, T>::value>::type>
+        void emit(U&& val) {
+            assign(std::forward<U>(val));
+        }
+        /* Emits a value constructed in place from the given arguments */
+        template <typename... Args>
+        T& emplace(Args&&... args) {
+            mark();
+            storage_.destroy();
+            storage_.construct(std::forward<Args>(args)...);
+            return storage_.get();
         }
         operator bool() const {
-            return is_present_;
+            return is_present();
         }
         bool has_emitted_val() const {
-            return has_emitted_val_;
+            return storage_.constructed;
         }
+        /* Only valid once a value has been emitted */
+        const T& val() const {
+            return storage_.get();
+        }
+        const internal::Presence* presence() const {
+            return this;
+        }
+    private:
+        /* Emitting again assigns to the existing value, so it can reuse what the value already owns */
+        template <typename U>
+        void assign(U&& val) {
+            mark();
+            if (storage_.constructed) {
+                storage_.get() = std::forward<U>(val);
+            } else {
+                storage_.construct(std::forward<U>(val));
+            }
+        }
+
+        internal::ValStorage<T> storage_;
+    };
+}
+
+namespace proto_activities {
+    /* Up to 64 pure signals sharing one presence - emitting and querying several of them is a single mask operation */
+    struct SignalSet : internal::Presence {
+        SignalSet(internal::Epoch& epoch) : Presence(epoch) {
+        }
+        template <typename... Ids>
+        void emit(Ids... ids) {
+            emit_mask(mask_of(ids...));
+        }
+        void emit_mask(uint64_t mask) {
+            if (!is_present()) {
+                mark();
+                mask_ = 0;
+            }
+            mask_ |= mask;
+        }
+        template <typename... Ids>
+        void clear(Ids... ids) {
+            mask_ &= ~mask_of(ids...);
+        }
+        /* The signals present in the current tick */
+        uint64_t mask() const {
+            return is_present() ? mask_ : 0;
+        }
+        struct Query {
+            const SignalSet* set;
+            uint64_t mask;
+            bool all;
+
+            operator bool() const {
+                const auto present = set->mask() & mask;
+                return all ? present == mask : present != 0;
+            }
+            const internal::Presence* presence() const {
+                return set;
+            }
+        };
+        template <typename... Ids>
+        Query any_of(Ids... ids) const {
+            return {this, mask_of(ids...), false};
+        }
+        template <typename... Ids>
+        Query all_of(Ids... ids) const {
+            return {this, mask_of(ids...), true};
+        }
+        operator bool() const {
+            return mask() != 0;
+        }
+        const internal::Presence* presence() const {
+            return this;
+        }
+
+        static constexpr uint64_t mask_of() {
+            return 0;
+        }
+        template <typename... Ids>
+        static constexpr uint64_t mask_of(uint8_t id, Ids... ids) {
+            return ((uint64_t)1 << id) | mask_of(ids...);
+        }
+
+    private:
+        uint64_t mask_{};
+    };
+}
+
+namespace proto_activities {
+    /* A fixed buffer which combined signals can append to - emits beyond its capacity are counted as dropped */
+    template <typename E, size_t N>
+    struct Bounded {
+        Bounded() {}
+        void clear() {
+            size_ = 0;
+            dropped_ = 0;
+        }
+        bool push(const E& item) {
+            if (size_ == N) {
+                ++dropped_;
+                return false;
+            }
+            items_[size_++] = item;
+            return true;
+        }
+        size_t size() const {
+            return size_;
+        }
+        size_t dropped() const {
+            return dropped_;
+        }
+        const E& operator[](size_t i) const {
+            return items_[i];
+        }
+        const E* begin() const {
+            return items_;
+        }
+        const E* end() const {
+            return items_ + size_;
+        }
+    private:
+        E items_[N];
+        size_t size_{};
+        size_t dropped_{};
+    };
+
+    /* Combine functions fold the emits of a tick - `init` takes the first emit and `fold` each further one */
+    namespace combine {
+        struct Assign {
+            template <typename T, typename V>
+            static void init(T& acc, const V& val) {
+                acc = val;
+            }
+        };
+        struct Sum : Assign {
+            template <typename T, typename V>
+            static void fold(T& acc, const V& val) {
+                acc += val;
+            }
+        };
+        struct Min : Assign {
+            template <typename T, typename V>
+            static void fold(T& acc, const V& val) {
+                if (val < acc) {
+                    acc = val;
+                }
+            }
+        };
+        struct Max : Assign {
+            template <typename T, typename V>
+            static void fold(T& acc, const V& val) {
+                if (acc < val) {
+                    acc = val;
+                }
+            }
+        };
+        struct Or : Assign {
+            template <typename T, typename V>
+            static void fold(T& acc, const V& val) {
+                acc |= val;
+            }
+        };
+        struct Append {
+            template <typename T, typename V>
+            static void init(T& acc, const V& val) {
+                acc.clear();
+                acc.push(val);
+            }
+            template <typename T, typename V>
+            static void fold(T& acc, const V& val) {
+                acc.push(val);
+            }
+        };
+    }
+
+    /* A valued signal which any number of trails may emit within a tick - the emits are combined in place */
+    template <typename T, typename Combine>
+    struct CombinedSignal final : internal::Presence {
+        CombinedSignal(internal::Epoch& epoch) : Presence(epoch) {
+        }
+        CombinedSignal& operator=(const CombinedSignal& other) {
+            Presence::operator=(other);
+            return *this;
+        }
+        template <typename V>
+        void emit(const V& val) {
+            if (is_present()) {
+                Combine::fold(value_, val);
+            } else {
+                mark();
+                Combine::init(value_, val);
+            }
+        }
+        operator bool() const {
+            return is_present();
+        }
+        /* The combination of all emits so far in this tick - only valid while present */
         const T& val() const {
             return value_;
         }
-        void update() final {
-            is_present_ = false;
+        const internal::Presence* presence() const {
+            return this;
         }
     private:
-        bool is_present_{};
-        bool has_emitted_val_{};
         T value_{};
     };
 }
 
+/* The bytes of the signals of a frame are summed at compile time for `frame_layout`: every definition adds an overload
+   of `_pa_signal_bytes` ranked by the counter at its definition, which adds its size to the one of the next lower rank.
+   A frame ends the chain at a floor below its own definitions - so a frame can hold up to 255 signal definitions. */
+#define _PA_MAX_SIGNAL_DEFS 255
+
+namespace proto_activities { namespace internal {
+    template <int N, int Floor>
+    struct SignalRank : SignalRank<N - 1, Floor> {};
+    template <int Floor>
+    struct SignalRank<Floor, Floor> {};
+} }
+
+#ifdef __COUNTER__
+#define _pa_signal_bytes_def(sig, k) \
+    template <int F> \
+    static constexpr size_t _pa_signal_bytes(proto_activities::internal::SignalRank<k, F>) { \
+        return sizeof(sig) + _pa_signal_bytes(proto_activities::internal::SignalRank<k - 1, F>{}); \
+    }
+#define _pa_signal_bytes_count(sig) _pa_signal_bytes_def(sig, __COUNTER__)
+
+#define _pa_signal_bytes_end_at(k) \
+    template <int F> \
+    static constexpr size_t _pa_signal_bytes(proto_activities::internal::SignalRank<F, F>) { \
+        return 0; \
+    } \
+    template <int K = k> \
+    static constexpr size_t _pa_signals_size() { \
+        return _pa_signal_bytes(proto_activities::internal::SignalRank<K, K - _PA_MAX_SIGNAL_DEFS - 1>{}); \
+    }
+#define _pa_signal_bytes_end _pa_signal_bytes_end_at(__COUNTER__)
+#else
+#define _pa_signal_bytes_count(sig)
+#define _pa_signal_bytes_end \
+    static constexpr size_t _pa_signals_size() { \
+        return 0; /* signals are counted as context without a counter */ \
+    }
+#endif
+
 using pa_signal = proto_activities::Signal;
-#define pa_signal_res pa_enter_res
-#define pa_def_signal(sig) pa_signal sig{_pa_enter};
+#define pa_signal_res proto_activities::internal::Epoch _pa_enter{};
+#define pa_def_signal(sig) pa_signal sig{_pa_enter}; _pa_signal_bytes_count(sig)
 #define pa_emit(sig) sig.emit();
 
 template <typename T>
 using pa_val_signal = proto_activities::ValSignal<T>;
-#define pa_def_val_signal(ty, sig) pa_val_signal<ty> sig{_pa_enter};
+#define pa_def_val_signal(ty, sig) pa_val_signal<ty> sig{_pa_enter}; _pa_signal_bytes_count(sig)
 #define pa_emit_val(sig, val) sig.emit(val);
 
+template <typename T, typename Combine>
+using pa_combined_signal = proto_activities::CombinedSignal<T, Combine>;
+template <typename E, size_t N>
+using pa_bounded = proto_activities::Bounded<E, N>;
+using pa_sum = proto_activities::combine::Sum;
+using pa_min = proto_activities::combine::Min;
+using pa_max = proto_activities::combine::Max;
+using pa_or = proto_activities::combine::Or;
+using pa_append = proto_activities::combine::Append;
+#define pa_def_combined_signal(ty, sig, combine) pa_combined_signal<ty, combine> sig{_pa_enter}; _pa_signal_bytes_count(sig)
+
+/* Declares the signal set type `nm` with the given signal names - use it outside of activities */
+#define pa_signal_set(nm, ...) \
+    struct nm : proto_activities::SignalSet { \
+        enum Id : uint8_t { __VA_ARGS__, _pa_count }; \
+        static_assert(_pa_count <= 64, "signal sets hold up to 64 signals"); \
+        using proto_activities::SignalSet::SignalSet; \
+    };
+#define pa_def_signal_set(ty, set) ty set{_pa_enter}; _pa_signal_bytes_count(set)
+#define pa_emit_set(set, ...) set.emit(__VA_ARGS__);
+#define pa_any_of(set, ...) (set).any_of(__VA_ARGS__)
+#define pa_all_of(set, ...) (set).all_of(__VA_ARGS__)
+
+#ifdef PA_USE_WAKE_SETS
+namespace proto_activities { namespace internal {
+    template <typename T>
+    bool wake_cond(pa_wake_t&, const T& cond) {
+        return static_cast<bool>(cond);
+    }
+    template <typename S>
+    bool wake_on_signal(pa_wake_t& wake, const S& sig) {
+        if (!sig) {
+            wake.mode = _PA_WAKE_SLEEP | _PA_WAKE_SIG;
+            wake.sig = sig.presence();
+            return false;
+        }
+        return true;
+    }
+    inline bool wake_cond(pa_wake_t& wake, const Signal& sig) {
+        return wake_on_signal(wake, sig);
+    }
+    template <typename T>
+    bool wake_cond(pa_wake_t& wake, const ValSignal<T>& sig) {
+        return wake_on_signal(wake, sig);
+    }
+    template <typename T, typename Combine>
+    bool wake_cond(pa_wake_t& wake, const CombinedSignal<T, Combine>& sig) {
+        return wake_on_signal(wake, sig);
+    }
+    inline bool wake_cond(pa_wake_t& wake, const SignalSet::Query& query) {
+        return wake_on_signal(wake, query);
+    }
+} }
+#endif
+
+#endif
+
+/* Spawn */
+
+#ifdef _PA_ENABLE_CPP
+
+namespace proto_activities {
+    /* The frames of a pool are free, or owned by exactly one `Spawned` list - both are linked through `next` */
+    template <typename F>
+    struct PoolBase {
+        F* frames;
+        uint16_t* next; /* 1-based, 0 ends a list */
+        uint16_t capacity;
+        uint16_t free{};
+        uint16_t fresh{}; /* frames from here on have never been used */
+
+        F* take(uint16_t& slot) {
+            if (free != 0) {
+                slot = free - 1;
+                free = next[slot];
+            } else if (fresh < capacity) {
+                slot = fresh++;
+            } else {
+                return nullptr;
+            }
+            return &frames[slot];
+        }
+        void put(uint16_t slot) {
+            next[slot] = free;
+            free = slot + 1;
+        }
+    };
+
+    /* A fixed number of frames to spawn activities of type `F` in - define pools outside of activity contexts */
+    template <typename F, size_t N>
+    class Pool : public PoolBase<F> {
+        static_assert(N > 0 && N < 0xffff, "capacity of pool must be between 1 and 65534");
+
+    public:
+        Pool() : PoolBase<F>{frames_, next_, N} {}
+        Pool(const Pool&) = delete;
+        Pool& operator=(const Pool&) = delete;
+
+    private:
+        F frames_[N]{};
+        uint16_t next_[N]{};
+    };
+
+    /* The spawned activities of an owner - resetting or destroying the owner aborts them and returns their frames
+       to the pool, which has to outlive the owner. The instances of an owner all live in the same pool - it can
+       only spawn from another one once they have all ended. */
+    template <typename F>
+    struct Spawned {
+        Spawned() = default;
+        Spawned(const Spawned&) = delete;
+        Spawned& operator=(const Spawned& other) {
+            clear();
+            return *this;
+        }
+        ~Spawned() {
+            clear();
+        }
+
+        F* spawn(PoolBase<F>& pool_) {
+            if (head == 0) {
+                pool = &pool_;
+            } else if (pool != &pool_) {
+                assert(!"instances of an owner must all be spawned from the same pool");
+                return nullptr;
+            }
+            uint16_t slot;
+            F* frame = pool->take(slot);
+            if (frame != nullptr) {
+                pool->next[slot] = head;
+                head = slot + 1;
+                ++count;
+            }
+            return frame;
+        }
+        F* frame(uint16_t slot) const {
+            return &pool->frames[slot];
+        }
+        uint16_t* next(uint16_t slot) const {
+            return &pool->next[slot];
+        }
+        /* Unlinks the frame `link` points to - it gets reset in case it is still running */
+        void release(uint16_t* link) {
+            const uint16_t slot = *link - 1;
+            *link = pool->next[slot];
+            pool->frames[slot].reset();
+            pool->put(slot);
+            --count;
+        }
+        void clear() {
+            while (head != 0) {
+                release(&head);
+            }
+        }
+
+        PoolBase<F>* pool{};
+        uint16_t head{};
+        uint16_t count{};
+    };
+}
+
+#define _pa_spawned_name(nm) nm##_spawned
+
+#define pa_def_pool(nm, pool, n) proto_activities::Pool<_pa_frame_type(nm), n> pool;
+#define pa_def_pool_ns(ns, nm, pool, n) proto_activities::Pool<_pa_frame_type(ns::nm), n> pool;
+
+#define pa_spawn_res(nm) proto_activities::Spawned<_pa_frame_type(nm)> _pa_spawned_name(nm){};
+#define pa_spawn_res_ns(ns, nm) proto_activities::Spawned<_pa_frame_type(ns::nm)> _pa_spawned_name(nm){};
+
+/* Spawns an instance of `nm` in `pool` - returns its frame or nullptr if the pool is exhausted */
+#define pa_spawn(nm, pool) pa_self._pa_spawned_name(nm).spawn(pool)
+#define pa_spawned_count(nm) (pa_self._pa_spawned_name(nm).count)
+
+/* Runs all spawned instances once - the pool slot of the instance being run is available as `pa_spawn_i` in the arguments */
+#define pa_tick_spawned(nm, ...) \
+    { \
+        auto& _pa_spawned = pa_self._pa_spawned_name(nm); \
+        for (uint16_t* _pa_spawn_link = &_pa_spawned.head; *_pa_spawn_link != 0;) { \
+            const uint16_t pa_spawn_i = *_pa_spawn_link - 1; \
+            auto* _pa_spawn_frame = _pa_spawned.frame(pa_spawn_i); \
+            if (_pa_wake_guard(_pa_spawn_frame, pa_current_time_ms, \
+                               nm(_pa_spawn_frame, pa_current_time_ms, ##__VA_ARGS__)) == PA_RC_WAIT) { \
+                _pa_spawn_link = _pa_spawned.next(pa_spawn_i); \
+            } else { \
+                _pa_spawned.release(_pa_spawn_link); \
+            } \
+        } \
+    }
+
+#endif
+
+/* Memory */
+
+#define pa_frame_size(nm) sizeof(_pa_frame_type(nm))
+
+/* Fails to compile if the frame of `nm` - including all nested frames - exceeds `bytes` */
+#ifndef _PA_ENABLE_CPP
+#define pa_budget(nm, bytes) _Static_assert(pa_frame_size(nm) <= (bytes), "frame of " #nm " exceeds its budget of " #bytes " bytes")
+#else
+#define pa_budget(nm, bytes) static_assert(pa_frame_size(nm) <= (bytes), "frame of " #nm " exceeds its budget of " #bytes " bytes")
+#endif
+
+#ifdef _PA_ENABLE_CPP
+
+_pa_has_field_definer(_pa_time);
+_pa_has_field_definer(_pa_co_waits);
+_pa_has_field_definer(_pa_co_ended);
+_pa_has_field_definer(_pa_defer);
+
+#define _pa_field_size_definer(field) \
+    namespace proto_activities { namespace internal { \
+        template <typename T> \
+        constexpr auto field_size_##field() -> typename std::enable_if<_pa_has_field(T, field), size_t>::type { \
+            return sizeof(std::declval<T>().field); \
+        } \
+        template <typename T> \
+        constexpr auto field_size_##field() -> typename std::enable_if<!_pa_has_field(T, field), size_t>::type { \
+            return 0; \
+        } \
+    } }
+
+_pa_field_size_definer(_pa_time);
+_pa_field_size_definer(_pa_co_waits);
+_pa_field_size_definer(_pa_co_ended);
+_pa_field_size_definer(_pa_defer);
+_pa_field_size_definer(_pa_enter);
+_pa_field_size_definer(_pa_susres);
+
+namespace proto_activities {
+    /* Where the bytes of a frame go - `context` holds the user context, the nested frames and the padding */
+    struct FrameLayout {
+        size_t total;
+        size_t control; /* program counter and wake set */
+        size_t time;
+        size_t co; /* trail states of `pa_co_res` */
+        size_t lifecycle; /* `pa_defer_res`, `pa_enter_res` and `pa_susres_res` */
+        size_t signals;
+        size_t context;
+    };
+
+    template <typename T>
+    FrameLayout frame_layout(const T&) {
+        FrameLayout layout{};
+        layout.total = sizeof(T);
+        layout.control = sizeof(internal::AnyFrame);
+        layout.time = internal::field_size__pa_time<T>();
+        layout.co = internal::field_size__pa_co_waits<T>() + internal::field_size__pa_co_ended<T>();
+        layout.lifecycle = internal::field_size__pa_defer<T>() + internal::field_size__pa_enter<T>() + internal::field_size__pa_susres<T>();
+        layout.signals = T::_pa_signals_size();
+        layout.context = layout.total - layout.control - layout.time - layout.co - layout.lifecycle - layout.signals;
+        return layout;
+    }
+}
+
+#define pa_frame_layout(nm) proto_activities::frame_layout(_pa_inst_name(nm))
+
 #endif
 
 /* Trigger */
 
 #define pa_init(nm) _pa_reset(&_pa_inst_name(nm));
-#define pa_tick_tm(tm, nm, ...) nm(&_pa_inst_name(nm), tm, ##__VA_ARGS__)
+#define pa_tick_tm(tm, nm, ...) _pa_wake_guard(&_pa_inst_name(nm), tm, nm(&_pa_inst_name(nm), tm, ##__VA_ARGS__))
 #ifndef ARDUINO
 #define pa_tick(nm, ...) pa_tick_tm(0, nm, ##__VA_ARGS__)
 #else
 #define pa_tick(nm, ...) pa_tick_tm(millis(), nm, ##__VA_ARGS__)
 #endif
 
+/* Returns the ms after a tick at `tm` until `nm` needs the next tick - or PA_TIME_INFINITE if only inputs can wake it */
+#ifdef PA_USE_WAKE_SETS
+#define pa_next_deadline_tm(tm, nm) _pa_wake_delay(&_pa_inst_name(nm)._pa_wake, tm)
+#else
+#define pa_next_deadline_tm(tm, nm) ((pa_time_t)0)
+#endif
+#ifndef ARDUINO
+#define pa_next_deadline(nm) pa_next_deadline_tm(0, nm)
+#else
+#define pa_next_deadline(nm) pa_next_deadline_tm(millis(), nm)
+#endif
+
+/* Batch */
+
+/* A batch keeps `n` instances of an activity together with their return codes (and wake sets) in dense arrays.
+   Ticking a batch only touches the frames of instances which are still running (and awake). */
+
+#define _pa_batch_name(nm) nm##_batch
+#define _pa_batch_count(nm) (sizeof(_pa_batch_name(nm).rcs) / sizeof(pa_rc_t))
+
+#ifdef PA_USE_WAKE_SETS
+#define _pa_batch_wake_res(n) pa_wake_t wakes[n];
+#define _pa_batch_wake_init(nm) memset(_pa_batch_name(nm).wakes, 0, sizeof(_pa_batch_name(nm).wakes));
+#define _pa_batch_is_awake(nm, tm) !_pa_wake_is_asleep(&_pa_batch_name(nm).wakes[pa_batch_i], tm)
+#define _pa_batch_wake_store(nm) _pa_batch_name(nm).wakes[pa_batch_i] = _pa_batch_name(nm).frames[pa_batch_i]._pa_wake;
+#else
+#define _pa_batch_wake_res(n)
+#define _pa_batch_wake_init(nm)
+#define _pa_batch_is_awake(nm, tm) true
+#define _pa_batch_wake_store(nm)
+#endif
+
+#define _pa_batch_def(ty, nm, n) \
+    struct { \
+        size_t waiting; \
+        pa_rc_t rcs[n]; \
+        _pa_batch_wake_res(n) \
+        _pa_frame_type(ty) frames[n]; \
+    } _pa_batch_name(nm)
+
+#ifndef _PA_ENABLE_CPP
+#define pa_use_batch(nm, n) _pa_batch_def(nm, nm, n);
+#else
+#define pa_use_batch(nm, n) _pa_batch_def(nm, nm, n){};
+#define pa_use_batch_ns(ns, nm, n) _pa_batch_def(ns::nm, nm, n){};
+#endif
+
+#define pa_init_batch(nm) \
+    for (size_t pa_batch_i = 0; pa_batch_i < _pa_batch_count(nm); ++pa_batch_i) { \
+        _pa_reset(&_pa_batch_name(nm).frames[pa_batch_i]); \
+    } \
+    memset(_pa_batch_name(nm).rcs, PA_RC_WAIT, sizeof(_pa_batch_name(nm).rcs)); \
+    _pa_batch_wake_init(nm); \
+    _pa_batch_name(nm).waiting = _pa_batch_count(nm);
+
+/* The index of the instance being ticked is available as `pa_batch_i` in the arguments */
+#define pa_tick_batch_tm(tm, nm, ...) \
+    for (size_t pa_batch_i = 0; pa_batch_i < _pa_batch_count(nm); ++pa_batch_i) { \
+        if (_pa_batch_name(nm).rcs[pa_batch_i] == PA_RC_WAIT && _pa_batch_is_awake(nm, tm)) { \
+            if ((_pa_batch_name(nm).rcs[pa_batch_i] = nm(&_pa_batch_name(nm).frames[pa_batch_i], tm, ##__VA_ARGS__)) != PA_RC_WAIT) { \
+                --_pa_batch_name(nm).waiting; \
+            } \
+            _pa_batch_wake_store(nm); \
+        } \
+    }
+#ifndef ARDUINO
+#define pa_tick_batch(nm, ...) pa_tick_batch_tm(0, nm, ##__VA_ARGS__)
+#else
+#define pa_tick_batch(nm, ...) pa_tick_batch_tm(millis(), nm, ##__VA_ARGS__)
+#endif
+
+#define pa_batch_waiting(nm) (_pa_batch_name(nm).waiting)
+#define pa_batch_rc(nm, i) (_pa_batch_name(nm).rcs[i])
+#define pa_batch_frame(nm, i) (&_pa_batch_name(nm).frames[i])
+
 /* Convenience */
 
 #define pa_end pa_activity_end
 
 #define pa_pause pa_await (true);
-#define pa_halt pa_await (false);
+#define pa_halt \
+    _pa_wake_never; \
+    pa_mark_and_wait; \
+    _pa_wake_never; \
+    pa_wait;
 
 #define pa_await_immediate(cond) \
     if (!(cond)) { \
@@ -606,14 +2137,21 @@ using pa_val_signal = proto_activities::ValSignal<T>;
     pa_repeat { \
         pa_await_immediate (cond);
 
-#define pa_every_ms(ms) \
+#define _pa_every_ms_templ(ms, fixed) \
     pa_self._pa_time = pa_current_time_ms - ms; \
     pa_repeat { \
-        pa_await_immediate (pa_current_time_ms - pa_self._pa_time >= ms); \
+        if (pa_current_time_ms - pa_self._pa_time < ms) { \
+            _pa_await_until (pa_current_time_ms - pa_self._pa_time >= ms, pa_self._pa_time, ms, fixed); \
+        } \
         pa_self._pa_time += ms;
 
+#define pa_every_ms(ms) _pa_every_ms_templ(ms, false)
 #define pa_every_s(s) pa_every_ms(s * 1000)
 
+/* Like pa_every_ms but for a period which never changes - it sleeps between the iterations with wake sets */
+#define pa_every_ms_const(ms) _pa_every_ms_templ(ms, true)
+#define pa_every_s_const(s) pa_every_ms_const(s * 1000)
+
 #define pa_every_end \
         pa_pause; \
     }
@@ -0,0 +1,239 @@
+/* proto_activities coroutines
+ *
+ * Copyright (c) 2022-2024, Framework Labs.
+ */
+
+#pragma once
+
+/* Includes */
+
+#include "proto_activities.h"
+
+#ifndef _PA_ENABLE_CORO
+#error "proto_activities_coro.h requires C++20 coroutines"
+#endif
+
+#include <coroutine>
+#include <exception> /* for std::terminate */
+#include <new>
+#include <utility>
+
+/* Frame Pool */
+
+namespace proto_activities::coro {
+
+    namespace internal {
+
+        /* Recycles coroutine frames in size classes, so running sub-activities does not hit the heap in steady state. */
+        class FramePool {
+        public:
+            FramePool() = default;
+            FramePool(const FramePool&) = delete;
+            FramePool& operator=(const FramePool&) = delete;
+            ~FramePool() {
+                for (auto* head : free_) {
+                    while (head) {
+                        auto* next = head->next;
+                        ::operator delete(head);
+                        head = next;
+                    }
+                }
+            }
+
+            void* alloc(size_t size) {
+                in_use_ += size;
+                const size_t cls = size_class(size);
+                if (cls >= num_classes) {
+                    return ::operator new(size);
+                }
+                if (auto* block = free_[cls]) {
+                    free_[cls] = block->next;
+                    return block;
+                }
+                return ::operator new((cls + 1) * granule);
+            }
+
+            void free(void* ptr, size_t size) {
+                in_use_ -= size;
+                const size_t cls = size_class(size);
+                if (cls >= num_classes) {
+                    ::operator delete(ptr);
+                    return;
+                }
+                auto* block = static_cast<Block*>(ptr);
+                block->next = free_[cls];
+                free_[cls] = block;
+            }
+
+            /* The bytes of all live coroutine frames of this thread. */
+            size_t in_use() const {
+                return in_use_;
+            }
+
+        private:
+            static constexpr size_t granule = 64;
+            static constexpr size_t num_classes = 16;
+
+            struct Block {
+                Block* next;
+            };
+
+            static size_t size_class(size_t size) {
+                return (size + granule - 1) / granule - 1;
+            }
+
+            Block* free_[num_classes]{};
+            size_t in_use_{};
+        };
+
+        inline FramePool& frame_pool() {
+            thread_local FramePool pool;
+            return pool;
+        }
+    }
+}
+
+/* Activity */
+
+namespace proto_activities::coro {
+
+    /* An activity written as a C++20 coroutine.
+       Locals live across pauses, so no context struct is needed. `co_await` on a sub-activity runs it: control
+       transfers directly into the sub-activity and back on its completion. Ticking resumes just the innermost
+       running activity, so the cost of a tick does not grow with the nesting depth. */
+    class Activity {
+    public:
+        struct promise_type;
+        using Handle = std::coroutine_handle<promise_type>;
+
+        struct FinalAwaiter {
+            bool await_ready() const noexcept {
+                return false;
+            }
+            std::coroutine_handle<> await_suspend(Handle handle) noexcept {
+                auto& promise = handle.promise();
+                if (!promise.continuation) {
+                    return std::noop_coroutine();
+                }
+                promise.root->leaf = promise.continuation;
+                return promise.continuation;
+            }
+            void await_resume() const noexcept {}
+        };
+
+        struct promise_type {
+            promise_type* root = this;
+            std::coroutine_handle<> leaf = Handle::from_promise(*this);
+            std::coroutine_handle<> continuation;
+
+            Activity get_return_object() {
+                return Activity{Handle::from_promise(*this)};
+            }
+            std::suspend_always initial_suspend() const noexcept {
+                return {};
+            }
+            FinalAwaiter final_suspend() const noexcept {
+                return {};
+            }
+            void return_void() const {}
+            void unhandled_exception() const {
+                std::terminate();
+            }
+
+            static void* operator new(size_t size) {
+                return internal::frame_pool().alloc(size);
+            }
+            static void operator delete(void* ptr, size_t size) {
+                internal::frame_pool().free(ptr, size);
+            }
+        };
+
+        Activity(Activity&& other) noexcept : handle_(std::exchange(other.handle_, {})) {}
+        Activity& operator=(Activity&& other) noexcept {
+            if (this != &other) {
+                destroy();
+                handle_ = std::exchange(other.handle_, {});
+            }
+            return *this;
+        }
+        ~Activity() {
+            destroy();
+        }
+
+        /* Runs the activity as a root until it pauses or ends. */
+        pa_rc_t tick() {
+            if (done()) {
+                return PA_RC_DONE;
+            }
+            handle_.promise().leaf.resume();
+            return done() ? PA_RC_DONE : PA_RC_WAIT;
+        }
+
+        bool done() const {
+            return !handle_ || handle_.done();
+        }
+
+        /* Awaiting an activity runs it as a sub-activity. */
+        bool await_ready() const noexcept {
+            return done();
+        }
+        template <typename Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> parent) noexcept {
+            auto& promise = handle_.promise();
+            promise.root = parent.promise().root;
+            promise.continuation = parent;
+            promise.root->leaf = handle_;
+            return handle_;
+        }
+        void await_resume() const noexcept {}
+
+    private:
+        explicit Activity(Handle handle) : handle_(handle) {}
+
+        void destroy() {
+            if (handle_) {
+                handle_.destroy();
+                handle_ = {};
+            }
+        }
+
+        Handle handle_;
+    };
+
+    /* Pauses the activity until the next tick. */
+    inline constexpr std::suspend_always pause{};
+
+    /* Waits for the next tick in which `cond` holds. */
+    template <typename Cond>
+    Activity await(Cond cond) {
+        do {
+            co_await pause;
+        } while (!cond());
+    }
+
+    /* Runs a callable returning `pa_rc_t` once per tick until it is done - e.g. a lambda which calls `pa_tick`. */
+    template <typename Tick>
+    Activity run(Tick tick) {
+        while (tick() == PA_RC_WAIT) {
+            co_await pause;
+        }
+    }
+
+    /* Runs the trails concurrently in the order given and ends once all of them did. */
+    template <typename... Trails>
+    Activity co(Trails... trails) {
+        Activity* all[] = {&trails...};
+        while (true) {
+            bool all_done = true;
+            for (auto* trail : all) {
+                if (trail->tick() == PA_RC_WAIT) {
+                    all_done = false;
+                }
+            }
+            if (all_done) {
+                co_return;
+            }
+            co_await pause;
+        }
+    }
+}
@@ -0,0 +1,143 @@
+/* proto_activities replay
+ *
+ * Copyright (c) 2022-2024, Framework Labs.
+ */
+
+#pragma once
+
+/* Includes */
+
+#include "proto_activities.h"
+
+#include <stdio.h>
+
+/* Log */
+
+/* Activities are determined by their frame, their arguments and the time, so a run can be recorded as the
+   sequence of its tick inputs and replayed later - e.g. against a new build to compare the time per tick and to
+   check that the outputs stay identical.
+   The inputs of a tick are a plain struct which the driver fills before every tick. The arguments of the root
+   activity refer to it, and signals injected from outside are fields of it which the root activity emits.
+   A record holds the time, the inputs and the return code of the tick - followed by any outputs appended with
+   pa_record_output. The log is written in host byte order. */
+
+#define PA_RC_REPLAY_END ((pa_rc_t)-2)
+
+typedef struct {
+    FILE* file;
+    uint32_t input_size;
+    pa_time_t time;
+    uint64_t ticks;
+    uint64_t mismatches;
+    bool failed;
+} pa_log_t;
+
+static const char _pa_log_magic[4] = {'P', 'A', 'L', 'G'};
+static const uint32_t _pa_log_version = 1;
+
+static inline bool _pa_log_write(pa_log_t* log, const void* data, size_t size) {
+    if (fwrite(data, 1, size, log->file) != size) {
+        log->failed = true;
+    }
+    return !log->failed;
+}
+
+static inline bool _pa_log_read(pa_log_t* log, void* data, size_t size) {
+    return fread(data, 1, size, log->file) == size;
+}
+
+static inline void _pa_log_init(pa_log_t* log, FILE* file, uint32_t input_size) {
+    log->file = file;
+    log->input_size = input_size;
+    log->time = 0;
+    log->ticks = 0;
+    log->mismatches = 0;
+    log->failed = false;
+}
+
+/* Record */
+
+/* Starts a log of ticks with inputs of `input_size` bytes - returns false if the header could not be written */
+static inline bool pa_record_open(pa_log_t* log, FILE* file, uint32_t input_size) {
+    _pa_log_init(log, file, input_size);
+    return _pa_log_write(log, _pa_log_magic, sizeof(_pa_log_magic)) &&
+           _pa_log_write(log, &_pa_log_version, sizeof(_pa_log_version)) &&
+           _pa_log_write(log, &input_size, sizeof(input_size));
+}
+
+static inline void _pa_record_inputs(pa_log_t* log, pa_time_t time, const void* inputs) {
+    _pa_log_write(log, &time, sizeof(time));
+    _pa_log_write(log, inputs, log->input_size);
+}
+
+static inline pa_rc_t _pa_record_rc(pa_log_t* log, pa_rc_t rc) {
+    _pa_log_write(log, &rc, sizeof(rc));
+    ++log->ticks;
+    return rc;
+}
+
+/* Appends outputs of the last tick to its record */
+static inline void pa_record_output(pa_log_t* log, const void* output, size_t size) {
+    _pa_log_write(log, output, size);
+}
+
+/* Records the inputs and ticks `nm` like pa_tick_tm - the inputs have to be a struct of `input_size` bytes */
+#define pa_record_tick_tm(log, tm, nm, inputs, ...) \
+    (_pa_record_inputs(log, tm, &(inputs)), _pa_record_rc(log, pa_tick_tm(tm, nm, ##__VA_ARGS__)))
+
+/* Replay */
+
+/* Opens a log for replay - returns false if it is no log or its inputs do not have `input_size` bytes */
+static inline bool pa_replay_open(pa_log_t* log, FILE* file, uint32_t input_size) {
+    char magic[sizeof(_pa_log_magic)];
+    uint32_t version, size;
+    _pa_log_init(log, file, input_size);
+    return _pa_log_read(log, magic, sizeof(magic)) && memcmp(magic, _pa_log_magic, sizeof(magic)) == 0 &&
+           _pa_log_read(log, &version, sizeof(version)) && version == _pa_log_version &&
+           _pa_log_read(log, &size, sizeof(size)) && size == input_size;
+}
+
+static inline bool _pa_replay_inputs(pa_log_t* log, void* inputs) {
+    return _pa_log_read(log, &log->time, sizeof(log->time)) && _pa_log_read(log, inputs, log->input_size);
+}
+
+static inline pa_rc_t _pa_replay_rc(pa_log_t* log, pa_rc_t rc) {
+    pa_rc_t recorded;
+    if (!_pa_log_read(log, &recorded, sizeof(recorded))) {
+        log->failed = true;
+        return PA_RC_REPLAY_END;
+    }
+    if (rc != recorded) {
+        ++log->mismatches;
+    }
+    ++log->ticks;
+    return rc;
+}
+
+/* Compares outputs of the last tick with the recorded ones - returns false and counts a mismatch if they differ */
+static inline bool pa_replay_output(pa_log_t* log, const void* output, size_t size) {
+    unsigned char recorded[64];
+    const unsigned char* actual = (const unsigned char*)output;
+    bool same = true;
+    while (size > 0) {
+        const size_t chunk = size < sizeof(recorded) ? size : sizeof(recorded);
+        if (!_pa_log_read(log, recorded, chunk)) {
+            log->failed = true;
+            return false;
+        }
+        same = same && memcmp(recorded, actual, chunk) == 0;
+        actual += chunk;
+        size -= chunk;
+    }
+    if (!same) {
+        ++log->mismatches;
+    }
+    return same;
+}
+
+/* Reads the inputs of the next record and ticks `nm` at its time - returns PA_RC_REPLAY_END after the last one.
+   A return code differing from the recorded one counts as a mismatch. */
+#define pa_replay_tick(log, nm, inputs, ...) \
+    (_pa_replay_inputs(log, &(inputs)) ? _pa_replay_rc(log, pa_tick_tm((log)->time, nm, ##__VA_ARGS__)) : PA_RC_REPLAY_END)
+
+#define pa_replay_mismatches(log) ((log)->mismatches)
@@ -0,0 +1,521 @@
+/* proto_activities threads
+ *
+ * Copyright (c) 2022-2024, Framework Labs.
+ */
+
+#pragma once
+
+/* Includes */
+
+#include "proto_activities.h"
+
+#ifndef _PA_ENABLE_CPP
+#error "proto_activities_threads.h requires the C++ meta model"
+#endif
+
+#include <atomic>
+#include <chrono> /* for std::chrono::steady_clock */
+#include <condition_variable>
+#include <cstddef> /* for std::max_align_t */
+#include <functional> /* for std::function */
+#include <mutex>
+#include <new> /* for placement new */
+#include <thread>
+#include <vector>
+
+/* Executor */
+
+namespace proto_activities {
+
+    /* Ticks independent root activities in parallel.
+       The roots are partitioned into shards - the first shard is ticked on the calling thread and every other
+       shard on its own worker thread. `tick` returns only after all shards are done, so ticks stay synchronous
+       at root level. Roots can be added and moved between shards in between ticks only. */
+    class Executor {
+    public:
+        using Root = std::function<pa_rc_t(pa_time_t)>;
+        using Duration = std::chrono::nanoseconds;
+
+        explicit Executor(size_t num_shards) : shards_(num_shards > 0 ? num_shards : 1) {
+            for (size_t shard = 1; shard < shards_.size(); ++shard) {
+                workers_.emplace_back([this, shard] { run_worker(shard); });
+            }
+        }
+        Executor(const Executor&) = delete;
+        Executor& operator=(const Executor&) = delete;
+        ~Executor() {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                is_stopping_ = true;
+            }
+            start_cond_.notify_all();
+            for (auto& worker : workers_) {
+                worker.join();
+            }
+        }
+
+        /* Adds a root - typically a lambda calling `pa_tick_tm` - to the shard with the fewest roots. */
+        size_t add(Root root) {
+            size_t shard = 0;
+            for (size_t i = 1; i < shards_.size(); ++i) {
+                if (shards_[i].roots.size() < shards_[shard].roots.size()) {
+                    shard = i;
+                }
+            }
+            return add(std::move(root), shard);
+        }
+        size_t add(Root root, size_t shard) {
+            roots_.push_back({std::move(root), PA_RC_WAIT, shard});
+            shards_[shard].roots.push_back(roots_.size() - 1);
+            ++shards_[shard].waiting;
+            return roots_.size() - 1;
+        }
+        void move(size_t root, size_t shard) {
+            auto& from = shards_[roots_[root].shard].roots;
+            for (size_t i = 0; i < from.size(); ++i) {
+                if (from[i] == root) {
+                    from.erase(from.begin() + i);
+                    break;
+                }
+            }
+            if (roots_[root].rc == PA_RC_WAIT) {
+                --shards_[roots_[root].shard].waiting;
+                ++shards_[shard].waiting;
+            }
+            shards_[shard].roots.push_back(root);
+            roots_[root].shard = shard;
+        }
+
+        /* Ticks all waiting roots and returns how many of them are still waiting. */
+        size_t tick(pa_time_t time) {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                time_ = time;
+                pending_ = shards_.size() - 1;
+                ++generation_;
+            }
+            start_cond_.notify_all();
+            tick_shard(0);
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                done_cond_.wait(lock, [this] { return pending_ == 0; });
+            }
+            size_t waiting = 0;
+            for (const auto& shard : shards_) {
+                waiting += shard.waiting;
+            }
+            return waiting;
+        }
+
+        size_t num_shards() const {
+            return shards_.size();
+        }
+        size_t shard_of(size_t root) const {
+            return roots_[root].shard;
+        }
+        pa_rc_t rc(size_t root) const {
+            return roots_[root].rc;
+        }
+
+        /* Latencies of a shard in the last tick and the maximum over all ticks - use these to rebalance. */
+        Duration shard_latency(size_t shard) const {
+            return shards_[shard].latency;
+        }
+        Duration shard_max_latency(size_t shard) const {
+            return shards_[shard].max_latency;
+        }
+
+    private:
+        struct RootState {
+            Root root;
+            pa_rc_t rc;
+            size_t shard;
+        };
+        struct Shard {
+            std::vector<size_t> roots;
+            size_t waiting{};
+            Duration latency{};
+            Duration max_latency{};
+        };
+
+        void tick_shard(size_t index) {
+            auto& shard = shards_[index];
+            const auto start = std::chrono::steady_clock::now();
+            for (const auto root : shard.roots) {
+                auto& state = roots_[root];
+                if (state.rc == PA_RC_WAIT && (state.rc = state.root(time_)) != PA_RC_WAIT) {
+                    --shard.waiting;
+                }
+            }
+            shard.latency = std::chrono::duration_cast<Duration>(std::chrono::steady_clock::now() - start);
+            if (shard.latency > shard.max_latency) {
+                shard.max_latency = shard.latency;
+            }
+        }
+        void run_worker(size_t shard) {
+            uint64_t seen_generation = 0;
+            while (true) {
+                {
+                    std::unique_lock<std::mutex> lock(mutex_);
+                    start_cond_.wait(lock, [&] { return generation_ != seen_generation || is_stopping_; });
+                    if (is_stopping_) {
+                        return;
+                    }
+                    seen_generation = generation_;
+                }
+                tick_shard(shard);
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    if (--pending_ == 0) {
+                        done_cond_.notify_one();
+                    }
+                }
+            }
+        }
+
+        std::vector<RootState> roots_;
+        std::vector<Shard> shards_;
+        std::vector<std::thread> workers_;
+        std::mutex mutex_;
+        std::condition_variable start_cond_;
+        std::condition_variable done_cond_;
+        uint64_t generation_{};
+        size_t pending_{};
+        pa_time_t time_{};
+        bool is_stopping_{};
+    };
+}
+
+/* Parallel Trails */
+
+namespace proto_activities {
+
+    namespace internal {
+        struct ParGroupBase {
+            size_t pending{}; /* guarded by the mutex of the pool */
+        };
+
+        struct ParTask {
+            pa_rc_t (*run)(void* fn);
+            void* fn;
+            ParGroupBase* group;
+            uint16_t trail;
+            bool is_strong;
+#ifdef PA_USE_WAKE_SETS
+            const pa_wake_t* wake;
+#endif
+            pa_rc_t rc; /* kept apart from the packed trail states, which are shared by all trails */
+            void operator()() {
+                rc = run(fn);
+            }
+        };
+
+        template <typename F>
+        pa_rc_t invoke_par_trail(void* fn) {
+            return (*static_cast<F*>(fn))();
+        }
+    }
+
+    /* Runs the trails marked by `pa_with_par` within `pa_co_par` sections on worker threads.
+       A joining thread runs those trails of its section itself which no worker has started yet. */
+    class TrailPool {
+    public:
+        explicit TrailPool(size_t num_workers, size_t capacity = 256) : capacity_(capacity) {
+            queue_.reserve(capacity);
+            for (size_t i = 0; i < num_workers; ++i) {
+                workers_.emplace_back([this] { run_worker(); });
+            }
+        }
+        TrailPool(const TrailPool&) = delete;
+        TrailPool& operator=(const TrailPool&) = delete;
+        ~TrailPool() {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                is_stopping_ = true;
+            }
+            work_cond_.notify_all();
+            for (auto& worker : workers_) {
+                worker.join();
+            }
+        }
+
+        bool push(internal::ParTask* task) {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (workers_.empty() || queue_.size() == capacity_) {
+                    return false;
+                }
+                queue_.push_back(task);
+                ++task->group->pending;
+            }
+            work_cond_.notify_one();
+            return true;
+        }
+        void join(internal::ParGroupBase* group) {
+            while (auto* task = retract(group)) {
+                (*task)();
+            }
+            std::unique_lock<std::mutex> lock(mutex_);
+            done_cond_.wait(lock, [group] { return group->pending == 0; });
+        }
+
+    private:
+        internal::ParTask* retract(internal::ParGroupBase* group) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (size_t i = 0; i < queue_.size(); ++i) {
+                auto* task = queue_[i];
+                if (task->group == group) {
+                    queue_[i] = queue_.back();
+                    queue_.pop_back();
+                    --group->pending;
+                    return task;
+                }
+            }
+            return nullptr;
+        }
+        void run_worker() {
+            while (true) {
+                internal::ParTask* task{};
+                {
+                    std::unique_lock<std::mutex> lock(mutex_);
+                    work_cond_.wait(lock, [this] { return !queue_.empty() || is_stopping_; });
+                    if (queue_.empty()) {
+                        return;
+                    }
+                    task = queue_.back();
+                    queue_.pop_back();
+                }
+                (*task)();
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    --task->group->pending;
+                }
+                done_cond_.notify_all();
+            }
+        }
+
+        std::vector<internal::ParTask*> queue_;
+        std::vector<std::thread> workers_;
+        std::mutex mutex_;
+        std::condition_variable work_cond_;
+        std::condition_variable done_cond_;
+        size_t capacity_;
+        bool is_stopping_{};
+    };
+
+    namespace internal {
+        inline TrailPool*& current_trail_pool() {
+            static TrailPool* pool{};
+            return pool;
+        }
+    }
+
+    /* Sets the pool used by all `pa_co_par` sections - without a pool, parallel trails run sequentially. */
+    inline void set_trail_pool(TrailPool* pool) {
+        internal::current_trail_pool() = pool;
+    }
+
+    template <size_t N>
+    class ParGroup : internal::ParGroupBase {
+    public:
+        ParGroup() : pool_(internal::current_trail_pool()) {}
+        ParGroup(const ParGroup&) = delete;
+        ParGroup& operator=(const ParGroup&) = delete;
+
+#ifdef PA_USE_WAKE_SETS
+        template <typename F>
+        void fork(const F& fn, uint16_t trail, bool is_strong, const pa_wake_t* wake) {
+            auto& task = tasks_[count_];
+            task = {&internal::invoke_par_trail<F>, store(fn), this, trail, is_strong, wake, PA_RC_WAIT};
+            ++count_;
+            if (pool_ == nullptr || !pool_->push(&task)) {
+                task();
+            }
+        }
+        void join(pa_wake_t& wake) {
+            join();
+            for (size_t i = 0; i < count_; ++i) {
+                if (tasks_[i].rc == PA_RC_WAIT) {
+                    _pa_wake_join(&wake, tasks_[i].wake);
+                }
+            }
+        }
+#else
+        template <typename F>
+        void fork(const F& fn, uint16_t trail, bool is_strong) {
+            auto& task = tasks_[count_];
+            task = {&internal::invoke_par_trail<F>, store(fn), this, trail, is_strong, PA_RC_WAIT};
+            ++count_;
+            if (pool_ == nullptr || !pool_->push(&task)) {
+                task();
+            }
+        }
+#endif
+        void join() {
+            if (pool_ != nullptr && count_ > 0) {
+                pool_->join(this);
+            }
+        }
+        /* Stores the states of the joined trails which have ended and counts them like `pa_co_end` does for sequential ones */
+        void count(pa_co_word_t* waits, uint16_t& ended, bool& any_done) {
+            for (size_t i = 0; i < count_; ++i) {
+                if (tasks_[i].rc == PA_RC_WAIT) {
+                    continue;
+                }
+                const uint16_t trail = tasks_[i].trail;
+                waits[trail / _PA_CO_WORD_BITS] &= (pa_co_word_t)~(1u << (trail % _PA_CO_WORD_BITS));
+                ended += tasks_[i].is_strong;
+                any_done = true;
+            }
+        }
+
+    private:
+        static constexpr size_t fn_capacity = 64;
+
+        /* The trail lambdas go out of scope before the join, so keep copies. */
+        template <typename F>
+        void* store(const F& fn) {
+            static_assert(sizeof(F) <= fn_capacity, "too many captures in parallel trail");
+            static_assert(std::is_trivially_copyable<F>::value, "parallel trail must capture by reference");
+            return new (fns_[count_]) F(fn);
+        }
+
+        TrailPool* pool_;
+        internal::ParTask tasks_[N];
+        alignas(std::max_align_t) unsigned char fns_[N][fn_capacity];
+        size_t count_{};
+    };
+}
+
+#ifdef PA_USE_WAKE_SETS
+#define _pa_par_wake_arg(alias) , &(_pa_inst_ptr(alias))->_pa_wake
+#else
+#define _pa_par_wake_arg(alias)
+#endif
+
+/* Like `pa_co` but trails marked with `pa_with_par` run in parallel on the pool set by `set_trail_pool`.
+   Parallel trails must only access their own frame and arguments - then the results equal a sequential run. */
+#define pa_co_par(n) _pa_co_templ(n, proto_activities::ParGroup<n> _pa_par;)
+
+/* A parallel trail is counted once joined - a weak one is noted when forked, as it might still be waiting */
+#define _pa_with_par_templ(nm, alias, call, is_strong, on_fork) \
+        _pa_seq_check_trail(alias); \
+        if (_pa_co_is_waiting(_pa_co_i)) { \
+            auto _pa_par_fn = [&]() -> pa_rc_t { return call; }; \
+            _pa_par.fork(_pa_par_fn, _pa_co_i, is_strong _pa_par_wake_arg(alias)); \
+            on_fork \
+        } \
+        _pa_co_strong += is_strong; \
+        ++_pa_co_i;
+
+#define pa_with_par(nm, ...) _pa_with_par_templ(nm, nm, _pa_call(nm, ##__VA_ARGS__), true, );
+#define pa_with_par_as(nm, alias, ...) _pa_with_par_templ(nm, alias, _pa_call_as(nm, alias, ##__VA_ARGS__), true, );
+
+#define pa_with_weak_par(nm, ...) _pa_with_par_templ(nm, nm, _pa_call(nm, ##__VA_ARGS__), false, _pa_co_weak_note(_pa_inst_ptr(nm), nm));
+#define pa_with_weak_par_as(nm, alias, ...) _pa_with_par_templ(nm, alias, _pa_call_as(nm, alias, ##__VA_ARGS__), false, _pa_co_weak_note(_pa_inst_ptr(alias), nm));
+
+/* Inputs */
+
+namespace proto_activities {
+
+    /* A bounded lock-free queue through which any number of threads can emit signals into the activities.
+       Signals fed by the queue are registered with `signals()` instead of an activity context.
+       Call `drain` on the ticking thread right before each tick: it retracts the signals of the previous tick and
+       emits the queued ones, so they are present for all activities during the tick. */
+    template <size_t N, size_t PayloadSize = 16>
+    class InputQueue {
+        static_assert(N > 0 && (N & (N - 1)) == 0, "capacity of input queue must be a power of two");
+
+    public:
+        InputQueue() {
+            for (size_t i = 0; i < N; ++i) {
+                cells_[i].sequence.store(i, std::memory_order_relaxed);
+            }
+        }
+        InputQueue(const InputQueue&) = delete;
+        InputQueue& operator=(const InputQueue&) = delete;
+
+        internal::Epoch& signals() {
+            return epoch_;
+        }
+
+        /* Enqueue emits from any thread - returns false if the queue is full. */
+        bool emit(Signal& sig) {
+            return push(&apply_signal, &sig, nullptr, 0);
+        }
+        /* The value converts to the type of the signal, as only the signal deduces it */
+        template <typename T>
+        bool emit(ValSignal<T>& sig, const typename ValSignal<T>::value_type& val) {
+            static_assert(std::is_trivially_copyable<T>::value, "values of input signals must be trivially copyable");
+            static_assert(sizeof(T) <= PayloadSize, "value of input signal exceeds the payload size of the queue");
+            return push(&apply_val_signal<T>, &sig, &val, sizeof(T));
+        }
+
+        /* Applies all queued emits on the ticking thread and returns their number. */
+        size_t drain() {
+            epoch_.invoke();
+            size_t count = 0;
+            while (true) {
+                auto& cell = cells_[dequeue_pos_ & (N - 1)];
+                if (cell.sequence.load(std::memory_order_acquire) != dequeue_pos_ + 1) {
+                    return count;
+                }
+                cell.apply(cell.target, cell.payload);
+                cell.sequence.store(dequeue_pos_ + N, std::memory_order_release);
+                ++dequeue_pos_;
+                ++count;
+            }
+        }
+
+    private:
+        using Apply = void (*)(void* target, const void* payload);
+
+        struct Cell {
+            std::atomic<size_t> sequence;
+            Apply apply;
+            void* target;
+            alignas(std::max_align_t) unsigned char payload[PayloadSize];
+        };
+
+        static void apply_signal(void* target, const void*) {
+            static_cast<Signal*>(target)->emit();
+        }
+        template <typename T>
+        static void apply_val_signal(void* target, const void* payload) {
+            T val;
+            memcpy(&val, payload, sizeof(T));
+            static_cast<ValSignal<T>*>(target)->emit(std::move(val));
+        }
+
+        bool push(Apply apply, void* target, const void* payload, size_t size) {
+            size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+            Cell* cell;
+            while (true) {
+                cell = &cells_[pos & (N - 1)];
+                const size_t sequence = cell->sequence.load(std::memory_order_acquire);
+                const intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+                if (diff == 0) {
+                    if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                        break;
+                    }
+                } else if (diff < 0) {
+                    return false;
+                } else {
+                    pos = enqueue_pos_.load(std::memory_order_relaxed);
+                }
+            }
+            cell->apply = apply;
+            cell->target = target;
+            if (size > 0) {
+                memcpy(cell->payload, payload, size);
+            }
+            cell->sequence.store(pos + 1, std::memory_order_release);
+            return true;
+        }
+
+        Cell cells_[N];
+        alignas(64) std::atomic<size_t> enqueue_pos_{};
+        alignas(64) size_t dequeue_pos_{};
+        internal::Epoch epoch_;
+    };
+}
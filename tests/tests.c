@@ -3,6 +3,7 @@
 /* Includes */
 
 #include "proto_activities.h"
+#include "proto_activities_replay.h"
 
 #include <stdio.h>
 #include <assert.h>
@@ -15,6 +16,9 @@
 
 pa_time_t current_time_ms = 0;
 
+PA_PROFILE_DEFINE
+PA_TRACE_DEFINE
+
 /* Helpers */
 
 pa_activity (Delay, pa_ctx(unsigned remaining), unsigned i) {
@@ -632,6 +636,572 @@ pa_activity (TestEvery, pa_ctx(pa_co_res(4); int value; int actual; int expected
     } pa_co_end;
 } pa_end;
 
+/* Wake Tests */
+
+#ifdef PA_USE_WAKE_SETS
+
+pa_activity (TestWakeHalt, pa_ctx(), int entries) {
+    pa_halt;
+} pa_end;
+
+pa_activity (TestWakeDelay, pa_ctx_tm(), int entries) {
+    pa_delay_ms_const (10);
+} pa_end;
+
+pa_activity (TestWakeRun, pa_ctx(pa_use(TestWakeDelay)), int entries) {
+    pa_run (TestWakeDelay, entries);
+} pa_end;
+
+pa_activity (TestWakeSpec, pa_ctx(), int* expected_halts, int* expected_delays, pa_time_t* local_current_time_ms) {
+    set_current_time_ms(0);
+    *expected_halts = 1;
+    *expected_delays = 1;
+    pa_pause;
+
+    /* Test that sleeping trails are skipped. */
+    set_current_time_ms(5);
+    pa_pause;
+
+    /* Test that the deadline wakes the trail. */
+    set_current_time_ms(10);
+    *expected_delays = 2;
+    pa_pause;
+} pa_end;
+
+pa_activity (TestWakeTest, pa_ctx(pa_co_res(2); pa_use(TestWakeHalt); pa_use(TestWakeRun)), int* halts, int* delays) {
+    pa_co(2) {
+        pa_with_weak (TestWakeHalt, ++*halts);
+        pa_with (TestWakeRun, ++*delays);
+    } pa_co_end;
+} pa_end;
+
+pa_activity (TestWakeCheck, pa_ctx(), int halts, int delays, int expected_halts, int expected_delays) {
+    pa_always {
+        assert(halts == expected_halts);
+        assert(delays == expected_delays);
+    } pa_always_end;
+} pa_end;
+
+pa_activity (TestWake, pa_ctx(pa_co_res(3); int halts; int delays; int expected_halts; int expected_delays;
+                              pa_use(TestWakeSpec); pa_use(TestWakeTest); pa_use(TestWakeCheck))) {
+    pa_co(3) {
+        pa_with_weak (TestWakeSpec, &pa_self.expected_halts, &pa_self.expected_delays, &pa_current_time_ms);
+        pa_with (TestWakeTest, &pa_self.halts, &pa_self.delays);
+        pa_with_weak (TestWakeCheck, pa_self.halts, pa_self.delays, pa_self.expected_halts, pa_self.expected_delays);
+    } pa_co_end;
+} pa_end;
+
+/* Deadline Tests */
+
+pa_activity (TestDeadline, pa_ctx_tm(pa_use(TestWakeRun); pa_use(TestWakeHalt)), int* count) {
+    pa_run (TestWakeRun, 0);
+    pa_after_ms_abort_const (20, TestWakeHalt, 0);
+    pa_every_ms_const (5) {
+        ++*count;
+    } pa_every_end;
+} pa_end;
+
+static void test_next_deadline(void) {
+    int count = 0;
+    pa_use(TestWakeHalt);
+    pa_use(TestDeadline);
+    pa_init(TestWakeHalt);
+    pa_init(TestDeadline);
+
+    /* Test that a halted activity only waits for inputs. */
+    assert(pa_tick_tm(0, TestWakeHalt, 0) == PA_RC_WAIT);
+    assert(pa_next_deadline_tm(0, TestWakeHalt) == PA_TIME_INFINITE);
+
+    /* Test deadline of delay. */
+    assert(pa_tick_tm(100, TestDeadline, &count) == PA_RC_WAIT);
+    assert(pa_next_deadline_tm(100, TestDeadline) == 10);
+    assert(pa_tick_tm(105, TestDeadline, &count) == PA_RC_WAIT);
+    assert(pa_next_deadline_tm(105, TestDeadline) == 5);
+
+    /* Test deadline of after ms abort. */
+    assert(pa_tick_tm(110, TestDeadline, &count) == PA_RC_WAIT);
+    assert(pa_next_deadline_tm(110, TestDeadline) == 20);
+
+    /* Test deadline of every ms. */
+    assert(pa_tick_tm(130, TestDeadline, &count) == PA_RC_WAIT);
+    assert(count == 1);
+    assert(pa_next_deadline_tm(130, TestDeadline) == 0);
+    assert(pa_tick_tm(131, TestDeadline, &count) == PA_RC_WAIT);
+    assert(pa_next_deadline_tm(131, TestDeadline) == 4);
+    assert(pa_tick_tm(135, TestDeadline, &count) == PA_RC_WAIT);
+    assert(count == 2);
+}
+
+#endif
+
+/* Wake Behavior Tests */
+
+pa_activity (TestDelayArg, pa_ctx_tm(), pa_time_t ms) {
+    pa_delay_ms (ms);
+} pa_end;
+
+pa_activity (TestEveryArg, pa_ctx_tm(), pa_time_t ms, int* count) {
+    pa_every_ms (ms) {
+        ++*count;
+    } pa_every_end;
+} pa_end;
+
+#ifdef PA_USE_WAKE_SETS
+pa_activity (TestDelayLiteral, pa_ctx_tm()) {
+    pa_delay_ms (10);
+} pa_end;
+#endif
+
+static void test_wake_behavior(void) {
+    int count = 0;
+    pa_use(TestDelayArg);
+    pa_use(TestEveryArg);
+    pa_init(TestDelayArg);
+    pa_init(TestEveryArg);
+
+    /* Test that a delay follows changes of its duration argument. */
+    assert(pa_tick_tm(0, TestDelayArg, 1000) == PA_RC_WAIT);
+    assert(pa_tick_tm(50, TestDelayArg, 100) == PA_RC_WAIT);
+    assert(pa_tick_tm(100, TestDelayArg, 100) == PA_RC_DONE);
+
+    /* Test that an every follows changes of its period argument. */
+    assert(pa_tick_tm(0, TestEveryArg, 1000, &count) == PA_RC_WAIT);
+    assert(count == 1);
+    assert(pa_tick_tm(50, TestEveryArg, 100, &count) == PA_RC_WAIT);
+    assert(pa_tick_tm(100, TestEveryArg, 100, &count) == PA_RC_WAIT);
+    assert(count == 2);
+
+#ifdef PA_USE_WAKE_SETS
+    /* Test that only the const variant of a delay sleeps - even if the duration is a literal. */
+    pa_use(TestDelayLiteral);
+    pa_init(TestDelayLiteral);
+    assert(pa_tick_tm(0, TestDelayLiteral) == PA_RC_WAIT);
+    assert(pa_next_deadline_tm(0, TestDelayLiteral) == 0);
+#endif
+}
+
+/* Mark Tests */
+
+pa_activity (TestMarks, pa_ctx(), int* value) {
+    *value = 1; pa_pause; *value = 2; pa_pause; *value = 3;
+} pa_end;
+
+/* Marks keep no state beyond the control state of the frame */
+pa_activity_ctx (TestMarksEmpty, );
+pa_budget(TestMarks, pa_frame_size(TestMarksEmpty));
+
+static void test_marks(void) {
+    int value = 0;
+    pa_use(TestMarks);
+    pa_init(TestMarks);
+
+    /* Test that marks on the same line resume at their own point. */
+    assert(pa_tick(TestMarks, &value) == PA_RC_WAIT && value == 1);
+    assert(pa_tick(TestMarks, &value) == PA_RC_WAIT && value == 2);
+    assert(pa_tick(TestMarks, &value) == PA_RC_DONE && value == 3);
+}
+
+/* Wide Co Tests */
+
+#define use_delays(p) \
+    pa_use_as(Delay, p##0); pa_use_as(Delay, p##1); pa_use_as(Delay, p##2); pa_use_as(Delay, p##3); \
+    pa_use_as(Delay, p##4); pa_use_as(Delay, p##5); pa_use_as(Delay, p##6); pa_use_as(Delay, p##7);
+
+#define with_weak_delays(p, ticks) \
+    pa_with_weak_as (Delay, p##0, ticks); pa_with_weak_as (Delay, p##1, ticks); \
+    pa_with_weak_as (Delay, p##2, ticks); pa_with_weak_as (Delay, p##3, ticks); \
+    pa_with_weak_as (Delay, p##4, ticks); pa_with_weak_as (Delay, p##5, ticks); \
+    pa_with_weak_as (Delay, p##6, ticks); pa_with_weak_as (Delay, p##7, ticks);
+
+#define with_delays(p, ticks) \
+    pa_with_as (Delay, p##0, ticks); pa_with_as (Delay, p##1, ticks); \
+    pa_with_as (Delay, p##2, ticks); pa_with_as (Delay, p##3, ticks); \
+    pa_with_as (Delay, p##4, ticks); pa_with_as (Delay, p##5, ticks); \
+    pa_with_as (Delay, p##6, ticks); pa_with_as (Delay, p##7, ticks);
+
+#define use_delays64(p) \
+    use_delays(p##0) use_delays(p##1) use_delays(p##2) use_delays(p##3) \
+    use_delays(p##4) use_delays(p##5) use_delays(p##6) use_delays(p##7)
+
+#define with_delays64(p, ticks) \
+    with_delays(p##0, ticks) with_delays(p##1, ticks) with_delays(p##2, ticks) with_delays(p##3, ticks) \
+    with_delays(p##4, ticks) with_delays(p##5, ticks) with_delays(p##6, ticks) with_delays(p##7, ticks)
+
+pa_activity (TestWideCo, pa_ctx(pa_co_res(34); use_delays(A) use_delays(B) use_delays(C) use_delays(D)
+                                pa_use_as(Delay, E0); pa_use_as(Delay, E1))) {
+    pa_co(34) {
+        with_weak_delays(A, 10);
+        with_weak_delays(B, 10);
+        with_weak_delays(C, 10);
+        with_weak_delays(D, 1);
+        pa_with_as (Delay, E0, 2);
+        pa_with_as (Delay, E1, 3);
+    } pa_co_end;
+    assert(pa_did_abort(A0) && pa_did_abort(C7));
+    assert(!pa_did_abort(D0) && !pa_did_abort(D7));
+} pa_end;
+
+pa_activity (TestHugeCo, pa_ctx(pa_co_res(264); use_delays64(A) use_delays64(B) use_delays64(C) use_delays64(D)
+                                use_delays(E))) {
+    pa_co(264) {
+        with_delays(E, 1);
+        with_delays64(A, 3);
+        with_delays64(B, 3);
+        with_delays64(C, 3);
+        with_delays64(D, 3);
+    } pa_co_end;
+} pa_end;
+
+pa_activity (TestCoLeaf, pa_ctx()) {
+    pa_halt;
+} pa_end;
+
+pa_activity (TestCoSmall, pa_ctx(pa_co_res(2); pa_use_as(TestCoLeaf, A); pa_use_as(TestCoLeaf, B))) {
+    pa_co(2) {
+        pa_with_as (TestCoLeaf, A);
+        pa_with_as (TestCoLeaf, B);
+    } pa_co_end;
+} pa_end;
+
+pa_activity (TestCoBody, pa_ctx(pa_co_res(2); pa_use(Delay); pa_use(TestCoLeaf)), unsigned* visits) {
+    pa_co(2) {
+        ++*visits;
+        pa_with (Delay, 2);
+        pa_with_weak (TestCoLeaf);
+    } pa_co_end;
+    assert(pa_did_abort(TestCoLeaf));
+} pa_end;
+
+pa_activity_ctx (TestCoSmallRef, uint8_t waits; uint16_t ended; pa_use_as(TestCoLeaf, A); pa_use_as(TestCoLeaf, B));
+
+static void test_wide_co(void) {
+    pa_use(TestWideCo);
+    pa_use(TestHugeCo);
+    pa_use(TestCoSmall);
+    pa_use(TestCoBody);
+    pa_init(TestWideCo);
+    pa_init(TestHugeCo);
+    pa_init(TestCoSmall);
+
+    /* Test that trail states are packed into bits. */
+    assert(sizeof(TestWideCo_inst._pa_co_waits) == 5);
+
+    /* Test that a small section costs a byte of trail states and the count of its ended trails. */
+    assert(sizeof(_pa_frame_type(TestCoSmall)) == sizeof(_pa_frame_type(TestCoSmallRef)));
+    assert(pa_tick(TestCoSmall) == PA_RC_WAIT);
+    assert(TestCoSmall_inst._pa_co_waits[0] == 0xff);
+
+    /* Test that the section waits for the strong trail in the last word. */
+    assert(pa_tick(TestWideCo) == PA_RC_WAIT);
+    assert(pa_tick(TestWideCo) == PA_RC_WAIT);
+    assert(pa_tick(TestWideCo) == PA_RC_WAIT);
+    assert(pa_tick(TestWideCo) == PA_RC_DONE);
+
+    /* Test that a section with more than 255 trails waits for all of them. */
+    assert(pa_tick(TestHugeCo) == PA_RC_WAIT);
+    assert(pa_tick(TestHugeCo) == PA_RC_WAIT);
+    assert(pa_tick(TestHugeCo) == PA_RC_WAIT);
+    assert(pa_tick(TestHugeCo) == PA_RC_DONE);
+
+    /* Test that the body of a section runs once per tick - also on the one it ends. */
+    unsigned visits = 0;
+    pa_init(TestCoBody);
+    assert(pa_tick(TestCoBody, &visits) == PA_RC_WAIT);
+    assert(pa_tick(TestCoBody, &visits) == PA_RC_WAIT);
+    assert(pa_tick(TestCoBody, &visits) == PA_RC_DONE);
+    assert(visits == 3);
+}
+
+/* Seq Tests */
+
+pa_activity (TestSeq, pa_ctx_tm(pa_use_seq(Delay, CountDown, Counter)), unsigned* value) {
+    pa_run (Delay, 2);
+    pa_run (CountDown, 3, value);
+    pa_after_abort (2, Counter, value);
+    pa_run (CountDown, 2, value);
+} pa_end;
+
+static void test_seq(void) {
+    unsigned value = 99;
+    pa_use(TestSeq);
+    pa_init(TestSeq);
+
+    /* Test that the frames share their storage. */
+    assert((void*)&TestSeq_inst.Delay_inst == (void*)&TestSeq_inst.CountDown_inst);
+    assert((void*)&TestSeq_inst.Delay_inst == (void*)&TestSeq_inst.Counter_inst);
+
+    assert(pa_tick(TestSeq, &value) == PA_RC_WAIT && value == 99);
+    assert(pa_tick(TestSeq, &value) == PA_RC_WAIT && value == 99);
+    assert(pa_tick(TestSeq, &value) == PA_RC_WAIT && value == 2);
+    assert(pa_tick(TestSeq, &value) == PA_RC_WAIT && value == 1);
+    assert(pa_tick(TestSeq, &value) == PA_RC_WAIT && value == 0);
+
+    /* Test that a frame starts cleared after its predecessor ended. */
+    value = 99;
+    assert(pa_tick(TestSeq, &value) == PA_RC_WAIT && value == 0);
+    assert(pa_tick(TestSeq, &value) == PA_RC_WAIT && value == 1);
+
+    /* Test that a frame starts cleared after its predecessor was aborted. */
+    assert(pa_tick(TestSeq, &value) == PA_RC_WAIT && value == 1);
+    assert(pa_tick(TestSeq, &value) == PA_RC_WAIT && value == 0);
+    assert(pa_tick(TestSeq, &value) == PA_RC_DONE);
+}
+
+/* Each Tests */
+
+pa_activity (TestEach, pa_ctx(pa_use_each(CountDown, 3); int slot), unsigned* values) {
+    /* Test that trails get consecutive slots. */
+    assert(pa_each_add(CountDown) == 0);
+    assert(pa_each_add(CountDown) == 1);
+    pa_tick_each (CountDown, pa_each_i + 2, &values[pa_each_i]);
+    assert(pa_each_count(CountDown) == 2);
+    pa_pause;
+
+    /* Test that trails can be added and removed while others keep running. */
+    assert(pa_each_add(CountDown) == 2);
+    assert(pa_each_add(CountDown) == -1);
+
+    /* Test that removing the slot of an add to a full set does nothing. */
+    pa_self.slot = pa_each_add(CountDown);
+    pa_each_remove(CountDown, pa_self.slot);
+    assert(!pa_each_is_running(CountDown, pa_self.slot));
+    assert(pa_each_count(CountDown) == 3);
+
+    pa_each_remove(CountDown, 1);
+    assert(!pa_each_is_running(CountDown, 1));
+    assert(pa_each_count(CountDown) == 2);
+    pa_co_each (CountDown, pa_each_i + 2, &values[pa_each_i]);
+
+    /* Test that slots get reused with a reset frame. */
+    pa_self.slot = pa_each_add(CountDown);
+    assert(pa_self.slot >= 0 && pa_self.slot < 3);
+    assert(pa_each_frame(CountDown, pa_self.slot)->remaining == 0);
+} pa_end;
+
+static void test_each(void) {
+    unsigned values[3] = {9, 9, 9};
+    pa_use(TestEach);
+    pa_init(TestEach);
+
+    assert(pa_tick(TestEach, values) == PA_RC_WAIT);
+    assert(values[0] == 1 && values[1] == 2 && values[2] == 9);
+    assert(pa_tick(TestEach, values) == PA_RC_WAIT);
+    assert(values[0] == 0 && values[1] == 2 && values[2] == 3);
+    assert(pa_tick(TestEach, values) == PA_RC_WAIT);
+    assert(values[2] == 2);
+    assert(pa_tick(TestEach, values) == PA_RC_WAIT);
+    assert(pa_tick(TestEach, values) == PA_RC_WAIT);
+    assert(values[2] == 0);
+    assert(pa_tick(TestEach, values) == PA_RC_DONE);
+}
+
+/* Batch Tests */
+
+static void test_batch(void) {
+    unsigned values[4];
+    pa_use_batch(CountDown, 4);
+    pa_init_batch(CountDown);
+
+    /* Test that each instance gets its own arguments. */
+    pa_tick_batch(CountDown, pa_batch_i + 1, &values[pa_batch_i]);
+    assert(pa_batch_waiting(CountDown) == 4);
+    assert(values[0] == 0 && values[1] == 1 && values[2] == 2 && values[3] == 3);
+
+    /* Test that finished instances are not ticked again. */
+    pa_tick_batch(CountDown, pa_batch_i + 1, &values[pa_batch_i]);
+    assert(pa_batch_waiting(CountDown) == 3);
+    assert(pa_batch_rc(CountDown, 0) == PA_RC_DONE);
+    assert(pa_batch_rc(CountDown, 1) == PA_RC_WAIT);
+    assert(values[1] == 0 && values[2] == 1 && values[3] == 2);
+
+    pa_tick_batch(CountDown, pa_batch_i + 1, &values[pa_batch_i]);
+    pa_tick_batch(CountDown, pa_batch_i + 1, &values[pa_batch_i]);
+    assert(pa_batch_waiting(CountDown) == 1);
+    pa_tick_batch(CountDown, pa_batch_i + 1, &values[pa_batch_i]);
+    assert(pa_batch_waiting(CountDown) == 0);
+
+    /* Test restart. */
+    pa_init_batch(CountDown);
+    assert(pa_batch_waiting(CountDown) == 4);
+    assert(pa_batch_frame(CountDown, 3)->remaining == 0);
+}
+
+/* Replay Tests */
+
+typedef struct {
+    unsigned value;
+    bool stop;
+} ReplayInputs;
+
+pa_activity (TestReplay, pa_ctx_tm(), const ReplayInputs* inputs, unsigned* total) {
+    while (!inputs->stop) {
+        *total += inputs->value;
+        pa_delay_ms (10);
+    }
+} pa_end;
+
+static void test_replay(void) {
+    FILE* file = tmpfile();
+    pa_log_t log;
+    ReplayInputs inputs = {0, false};
+    unsigned total = 0;
+    pa_rc_t rc;
+
+    /* Record a run which depends on the inputs and the time. */
+    pa_use(TestReplay);
+    pa_init(TestReplay);
+    assert(pa_record_open(&log, file, sizeof(inputs)));
+    pa_time_t tm = 0;
+    do {
+        inputs.value = tm;
+        inputs.stop = tm >= 60;
+        rc = pa_record_tick_tm(&log, tm, TestReplay, inputs, &inputs, &total);
+        pa_record_output(&log, &total, sizeof(total));
+        tm += 5;
+    } while (rc == PA_RC_WAIT);
+    assert(log.ticks == 13 && total == 0 + 10 + 20 + 30 + 40 + 50);
+    assert(!log.failed);
+
+    /* Test that replaying re-drives the activity to identical outputs. */
+    rewind(file);
+    pa_init(TestReplay);
+    total = 0;
+    assert(pa_replay_open(&log, file, sizeof(inputs)));
+    while (pa_replay_tick(&log, TestReplay, inputs, &inputs, &total) != PA_RC_REPLAY_END) {
+        assert(pa_replay_output(&log, &total, sizeof(total)));
+    }
+    assert(log.ticks == 13 && pa_replay_mismatches(&log) == 0 && !log.failed);
+
+    /* Test that differing outputs are detected. */
+    rewind(file);
+    pa_init(TestReplay);
+    total = 1;
+    assert(pa_replay_open(&log, file, sizeof(inputs)));
+    while (pa_replay_tick(&log, TestReplay, inputs, &inputs, &total) != PA_RC_REPLAY_END) {
+        pa_replay_output(&log, &total, sizeof(total));
+    }
+    assert(pa_replay_mismatches(&log) == 13);
+
+    /* Test that logs of other inputs are rejected. */
+    rewind(file);
+    assert(!pa_replay_open(&log, file, sizeof(inputs) + 1));
+    fclose(file);
+}
+
+/* Profile Tests */
+
+#ifdef PA_PROFILE
+
+pa_activity (TestProfileLeaf, pa_ctx()) {
+    pa_pause;
+} pa_end;
+
+pa_activity (TestProfileRoot, pa_ctx(pa_co_res(2); pa_use_as(TestProfileLeaf, Leaf1); pa_use_as(TestProfileLeaf, Leaf2))) {
+    pa_co(2) {
+        pa_with_as (TestProfileLeaf, Leaf1);
+        pa_with_as (TestProfileLeaf, Leaf2);
+    } pa_co_end;
+} pa_end;
+
+static const pa_profile_t* find_profile(const char* name) {
+    for (const pa_profile_t* profile = pa_profile_first(); profile; profile = profile->next) {
+        if (strcmp(profile->name, name) == 0) {
+            return profile;
+        }
+    }
+    return NULL;
+}
+
+static void test_profile(void) {
+    pa_use(TestProfileRoot);
+    pa_init(TestProfileRoot);
+    pa_profile_reset();
+
+    while (pa_tick(TestProfileRoot) == PA_RC_WAIT) {}
+
+    const pa_profile_t* root = find_profile("TestProfileRoot");
+    const pa_profile_t* leaf = find_profile("TestProfileLeaf");
+    assert(root && leaf);
+
+    /* Test that every entry is counted - both leaves share the profile of their type. */
+    assert(root->calls == 2 && leaf->calls == 4);
+
+    /* Test that the time of the leaves is excluded from the root. */
+    assert(root->exclusive <= root->inclusive && leaf->exclusive == leaf->inclusive);
+    assert(root->inclusive >= leaf->inclusive + root->exclusive);
+    assert(root->max_tick <= root->inclusive && leaf->max_tick <= leaf->inclusive);
+}
+
+#endif
+
+/* Trace Tests */
+
+#ifdef PA_TRACE
+
+pa_activity (TestTraceLeaf, pa_ctx(), bool* go) {
+    pa_await (*go);
+} pa_end;
+
+pa_activity (TestTraceRoot, pa_ctx(pa_co_res(2); pa_use(TestTraceLeaf); pa_use(Delay)), bool* go) {
+    pa_co(2) {
+        pa_with (TestTraceLeaf, go);
+        pa_with (Delay, 1);
+    } pa_co_end;
+    pa_when_abort (true, Delay, 3);
+} pa_end;
+
+static size_t count_events(const pa_trace_ring_t* ring, uint8_t kind) {
+    size_t count = 0;
+    for (uint64_t i = 0; i < ring->count; ++i) {
+        count += ring->events[i].kind == kind;
+    }
+    return count;
+}
+
+static void test_trace(void) {
+    pa_trace_event_t events[64];
+    pa_trace_ring_t ring;
+    pa_trace_init(&ring, events, 64, 1);
+    bool go = false;
+    pa_use(TestTraceRoot);
+    pa_init(TestTraceRoot);
+
+    /* Test that nothing is recorded before attaching a ring. */
+    pa_tick(TestTraceRoot, &go);
+    pa_trace_attach(&ring);
+    assert(ring.count == 0);
+
+    go = true;
+    while (pa_tick(TestTraceRoot, &go) == PA_RC_WAIT) {}
+    pa_trace_attach(NULL);
+
+    /* Test that trails, checks and aborts are recorded between balanced entries and exits. */
+    assert(ring.count <= 64);
+    assert(count_events(&ring, PA_TRACE_ENTER) == count_events(&ring, PA_TRACE_EXIT));
+    assert(count_events(&ring, PA_TRACE_TRAIL) == 2);
+    assert(count_events(&ring, PA_TRACE_AWAIT) >= 1);
+    assert(events[0].kind == PA_TRACE_ENTER && strcmp(events[0].name, "TestTraceRoot") == 0);
+    assert(events[1].kind == PA_TRACE_TRAIL && strcmp(events[1].name, "TestTraceLeaf") == 0 && events[1].arg == 0);
+    assert(events[3].kind == PA_TRACE_AWAIT && (events[3].arg & 1) && (events[3].arg >> 1) > 0);
+    assert(count_events(&ring, PA_TRACE_ABORT) == 1);
+    for (uint64_t i = 1; i < ring.count; ++i) {
+        assert(events[i].time >= events[i - 1].time);
+    }
+
+    /* Test the conversion into the Chrome trace format. */
+    char json[4096] = {0};
+    FILE* out = tmpfile();
+    pa_trace_ring_t* rings[] = {&ring};
+    pa_trace_write_json(out, rings, 1);
+    rewind(out);
+    fread(json, 1, sizeof(json) - 1, out);
+    fclose(out);
+    assert(strncmp(json, "{\"traceEvents\":[", 16) == 0);
+    assert(strstr(json, "\"name\":\"TestTraceRoot\"") && strstr(json, "\"ph\":\"E\""));
+}
+
+#endif
+
 /* Test Driver */
 
 #define run_test(nm) \
@@ -649,6 +1219,24 @@ int main(int argc, char* argv[]) {
     run_test(TestWhenAbort);
     run_test(TestWhenReset);
     run_test(TestEvery);
+    test_wake_behavior();
+    test_marks();
+    test_wide_co();
+    test_seq();
+    test_each();
+    test_batch();
+    test_replay();
+#ifdef PA_TRACE
+    test_trace();
+#endif
+#ifdef PA_PROFILE
+    test_profile();
+    pa_profile_dump(stdout);
+#endif
+#ifdef PA_USE_WAKE_SETS
+    run_test(TestWake);
+    test_next_deadline();
+#endif
 
     printf("Done\n");
 
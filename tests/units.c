@@ -0,0 +1,65 @@
+/* units.c
+ *
+ * Tests that tracing and profiling see the activities of all translation units.
+ */
+
+#include "units.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+PA_PROFILE_DEFINE
+PA_TRACE_DEFINE
+
+pa_activity (UnitsRoot, pa_ctx(pa_use(UnitsLeaf)), unsigned* count) {
+    pa_run (UnitsLeaf, count);
+} pa_end;
+
+static const pa_profile_t* find_profile(const char* name) {
+    for (const pa_profile_t* profile = pa_profile_first(); profile; profile = profile->next) {
+        if (strcmp(profile->name, name) == 0) {
+            return profile;
+        }
+    }
+    return NULL;
+}
+
+static unsigned count_named(const pa_trace_ring_t* ring, uint8_t kind, const char* name) {
+    unsigned n = 0;
+    for (uint64_t i = 0; i < ring->count; ++i) {
+        n += ring->events[i].kind == kind && strcmp(ring->events[i].name, name) == 0;
+    }
+    return n;
+}
+
+int main(int argc, char* argv[]) {
+    pa_trace_event_t events[64];
+    pa_trace_ring_t ring;
+    pa_trace_init(&ring, events, 64, 1);
+    pa_trace_attach(&ring);
+
+    unsigned count = 0;
+    pa_use(UnitsRoot);
+    for (pa_time_t tm = 0; tm < 3; ++tm) {
+        pa_tick_tm(tm, UnitsRoot, &count);
+    }
+    pa_trace_attach(NULL);
+
+    /* Test that the leaf of the other translation unit records into the attached ring. */
+    assert(count == 3);
+    assert(count_named(&ring, PA_TRACE_ENTER, "UnitsRoot") == 3);
+    assert(count_named(&ring, PA_TRACE_ENTER, "UnitsLeaf") == 3);
+    assert(count_named(&ring, PA_TRACE_EXIT, "UnitsLeaf") == 3);
+
+    /* Test that the leaf of the other translation unit is profiled as a child of the root. */
+    const pa_profile_t* root = find_profile("UnitsRoot");
+    const pa_profile_t* leaf = find_profile("UnitsLeaf");
+    assert(root && leaf);
+    assert(leaf->calls == 3);
+    assert(root->exclusive == root->inclusive - leaf->inclusive);
+    assert(leaf->tick == root->tick);
+
+    printf("Done\n");
+    return 0;
+}
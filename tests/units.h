@@ -0,0 +1,10 @@
+/* units.h
+ *
+ * Activities shared by the translation units of tests_units.
+ */
+
+#pragma once
+
+#include "proto_activities.h"
+
+pa_activity_decl (UnitsLeaf, pa_ctx(), unsigned* count);
@@ -0,0 +1,9 @@
+/* units_leaf.c */
+
+#include "units.h"
+
+pa_activity_def (UnitsLeaf, unsigned* count) {
+    pa_always {
+        ++*count;
+    } pa_always_end;
+} pa_end;
@@ -3,8 +3,16 @@
 // Includes
 
 #include "proto_activities.h"
+#include "proto_activities_threads.h"
+#ifdef _PA_ENABLE_CORO
+#include "proto_activities_coro.h"
+#endif
 
+#include <cstdlib>
 #include <iostream>
+#include <string>
+#include <vector>
+#include <new>
 #include <assert.h>
 
 // Defines
@@ -15,6 +23,25 @@
 // Gobals
 
 pa_time_t current_time_ms{};
+std::atomic<size_t> allocations{};
+
+// Allocation Counting
+
+void* operator new(size_t size) {
+    ++allocations;
+    if (void* ptr = malloc(size)) {
+        return ptr;
+    }
+    throw std::bad_alloc{};
+}
+
+void operator delete(void* ptr) noexcept {
+    free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+    free(ptr);
+}
 
 // Helpers
 
@@ -43,6 +70,13 @@ pa_activity (Counter, pa_ctx(unsigned value), unsigned& res) {
 
 } // namespace helpers
 
+// Frame Tests
+
+static_assert(!std::is_polymorphic<helpers::Delay_frame>::value, "frames must not have a vtable");
+static_assert(std::is_trivially_destructible<helpers::Delay_frame>::value, "plain frames must be trivial to destroy");
+static_assert(!std::is_polymorphic<pa_signal>::value, "signals must not have a vtable");
+pa_budget(helpers::Delay, sizeof(proto_activities::internal::AnyFrame) + sizeof(unsigned) * 2);
+
 // Tests
 
 namespace tests {
@@ -839,6 +873,16 @@ pa_activity (TestSignalsBody, pa_ctx(pa_signal_res; pa_use(TestSignalsBodySub);
 } pa_end
 
 pa_activity (TestSignals, pa_ctx_tm(pa_use(TestSignalsBody))) {
+    {
+        // Test that the layout accounts for every byte.
+        const auto layout = proto_activities::frame_layout(pa_self.TestSignalsBody_inst);
+        assert(layout.total == sizeof(TestSignalsBody_frame));
+        assert(layout.lifecycle == sizeof(proto_activities::internal::Epoch));
+        assert(layout.signals == 2 * sizeof(pa_signal));
+        static_assert(TestSignalsBody_frame::_pa_signals_size() == 2 * sizeof(pa_signal), "signal bytes are summed at compile time");
+        static_assert(sizeof(proto_activities::internal::Epoch) == sizeof(uint64_t), "an epoch is a single counter");
+        assert(layout.control + layout.time + layout.co + layout.lifecycle + layout.signals + layout.context == layout.total);
+    }
     pa_run (TestSignalsBody);
     pa_run (TestSignalsBody); // Test re-invocation
     pa_after_abort (2, TestSignalsBody);
@@ -893,8 +937,600 @@ pa_activity (TestValSignals, pa_ctx_tm(pa_use(TestValSignalsBody))) {
     pa_run (TestValSignalsBody); // Test re-invocation after abort
 } pa_end
 
+using Readings = pa_bounded<int, 2>;
+
+pa_activity (TestCombinedSignalsEmitter, pa_ctx(), int reading, pa_combined_signal<int, pa_sum>& sum,
+                                                   pa_combined_signal<int, pa_max>& max, pa_combined_signal<Readings, pa_append>& readings) {
+    pa_emit_val(sum, reading);
+    pa_emit_val(max, reading);
+    pa_emit_val(readings, reading);
+    pa_pause;
+    pa_emit_val(sum, reading);
+} pa_end
+
+pa_activity (TestCombinedSignalsReader, pa_ctx(), pa_combined_signal<int, pa_sum>& sum,
+                                                  pa_combined_signal<int, pa_max>& max, pa_combined_signal<Readings, pa_append>& readings) {
+    // Test that all emits of the tick are combined.
+    assert(sum && sum.val() == 6);
+    assert(max && max.val() == 3);
+    assert(readings && readings.val().size() == 2 && readings.val().dropped() == 1);
+    assert(readings.val()[0] == 1 && readings.val()[1] == 3);
+    pa_pause;
+
+    // Test that the combination restarts in the next tick.
+    assert(sum && sum.val() == 6);
+    assert(!max && !readings);
+} pa_end
+
+pa_activity (TestCombinedSignals, pa_ctx(pa_signal_res; pa_co_res(4);
+                                         pa_use_as(TestCombinedSignalsEmitter, E1); pa_use_as(TestCombinedSignalsEmitter, E2);
+                                         pa_use_as(TestCombinedSignalsEmitter, E3); pa_use(TestCombinedSignalsReader);
+                                         pa_def_combined_signal(int, sum, pa_sum); pa_def_combined_signal(int, max, pa_max);
+                                         pa_def_combined_signal(Readings, readings, pa_append))) {
+    pa_co(4) {
+        pa_with_as (TestCombinedSignalsEmitter, E1, 1, pa_self.sum, pa_self.max, pa_self.readings);
+        pa_with_as (TestCombinedSignalsEmitter, E2, 3, pa_self.sum, pa_self.max, pa_self.readings);
+        pa_with_as (TestCombinedSignalsEmitter, E3, 2, pa_self.sum, pa_self.max, pa_self.readings);
+        pa_with (TestCombinedSignalsReader, pa_self.sum, pa_self.max, pa_self.readings);
+    } pa_co_end;
+} pa_end
+
+pa_signal_set(Buttons, Up, Down, Left, Right);
+
+pa_activity (TestSignalSetBodySub, pa_ctx(), Buttons& buttons) {
+    pa_await (pa_all_of(buttons, Buttons::Up, Buttons::Right));
+    assert(buttons.mask() == Buttons::mask_of(Buttons::Up, Buttons::Right));
+} pa_end
+
+pa_activity (TestSignalSetBodyEmitter, pa_ctx(), Buttons& buttons) {
+    pa_emit_set(buttons, Buttons::Up);
+    pa_pause;
+    pa_emit_set(buttons, Buttons::Right);
+    pa_pause;
+    pa_emit_set(buttons, Buttons::Up, Buttons::Right);
+} pa_end
+
+pa_activity (TestSignalSetBody, pa_ctx(pa_signal_res; pa_co_res(2); pa_use(TestSignalSetBodySub); pa_use(TestSignalSetBodyEmitter);
+                                       pa_def_signal_set(Buttons, buttons))) {
+    assert(!pa_self.buttons);
+    pa_emit_set(pa_self.buttons, Buttons::Up, Buttons::Left);
+    assert(pa_self.buttons);
+    assert(pa_any_of(pa_self.buttons, Buttons::Left, Buttons::Right));
+    assert(!pa_any_of(pa_self.buttons, Buttons::Down, Buttons::Right));
+    assert(!pa_all_of(pa_self.buttons, Buttons::Up, Buttons::Down));
+    pa_self.buttons.clear(Buttons::Up, Buttons::Left);
+    assert(!pa_self.buttons);
+    pa_emit_set(pa_self.buttons, Buttons::Down);
+    pa_pause;
+
+    // Test that the presence of the whole set is retracted.
+    assert(!pa_self.buttons);
+    assert(!pa_any_of(pa_self.buttons, Buttons::Down));
+
+    pa_co(2) {
+        pa_with (TestSignalSetBodyEmitter, pa_self.buttons);
+        pa_with (TestSignalSetBodySub, pa_self.buttons);
+    } pa_co_end;
+} pa_end
+
+pa_activity (TestSignalSet, pa_ctx_tm(pa_use(TestSignalSetBody))) {
+    static_assert(sizeof(Buttons) == sizeof(pa_signal) + sizeof(uint64_t), "a set costs one mask over a single signal");
+    pa_run (TestSignalSetBody);
+    pa_after_abort (1, TestSignalSetBody);
+    pa_run (TestSignalSetBody); // Test re-invocation after abort
+} pa_end
+
+// Wake Tests
+
+#ifdef PA_USE_WAKE_SETS
+
+pa_activity (TestWakeHalt, pa_ctx(), int entries) {
+    pa_halt;
+} pa_end
+
+pa_activity (TestWakeDelay, pa_ctx_tm(), int entries) {
+    pa_delay_ms_const (10);
+} pa_end
+
+pa_activity (TestWakeSignal, pa_ctx(), int entries, pa_signal& sig) {
+    pa_await (sig);
+} pa_end
+
+pa_activity (TestWakeSpec, pa_ctx(), int& expected_halts, int& expected_delays, int& expected_signals,
+                                      pa_signal& sig, pa_time_t& local_current_time_ms) {
+    set_current_time_ms(0);
+    expected_halts = 1;
+    expected_delays = 1;
+    expected_signals = 1;
+    pa_pause;
+
+    // Test that the signal waiter goes to sleep after its first check.
+    set_current_time_ms(5);
+    expected_signals = 2;
+    pa_pause;
+
+    // Test that sleeping trails are skipped.
+    pa_pause;
+
+    // Test that the signal and the deadline wake their trails.
+    set_current_time_ms(10);
+    pa_emit(sig);
+    expected_delays = 2;
+    expected_signals = 3;
+    pa_pause;
+} pa_end
+
+pa_activity (TestWakeTest, pa_ctx(pa_co_res(3); pa_use(TestWakeHalt); pa_use(TestWakeDelay); pa_use(TestWakeSignal)),
+                           int& halts, int& delays, int& signals, pa_signal& sig) {
+    pa_co(3) {
+        pa_with_weak (TestWakeHalt, ++halts);
+        pa_with (TestWakeDelay, ++delays);
+        pa_with (TestWakeSignal, ++signals, sig);
+    } pa_co_end;
+} pa_end
+
+pa_activity (TestWakeCheck, pa_ctx(), int halts, int delays, int signals,
+                                      int expected_halts, int expected_delays, int expected_signals) {
+    pa_always {
+        assert(halts == expected_halts);
+        assert(delays == expected_delays);
+        assert(signals == expected_signals);
+    } pa_always_end;
+} pa_end
+
+pa_activity (TestWake, pa_ctx(pa_co_res(3); pa_signal_res; pa_def_signal(sig);
+                              int halts = 0; int delays = 0; int signals = 0;
+                              int expected_halts = 0; int expected_delays = 0; int expected_signals = 0;
+                              pa_use(TestWakeSpec); pa_use(TestWakeTest); pa_use(TestWakeCheck))) {
+    pa_co(3) {
+        pa_with_weak (TestWakeSpec, pa_self.expected_halts, pa_self.expected_delays, pa_self.expected_signals,
+                                    pa_self.sig, pa_current_time_ms);
+        pa_with (TestWakeTest, pa_self.halts, pa_self.delays, pa_self.signals, pa_self.sig);
+        pa_with_weak (TestWakeCheck, pa_self.halts, pa_self.delays, pa_self.signals,
+                                     pa_self.expected_halts, pa_self.expected_delays, pa_self.expected_signals);
+    } pa_co_end;
+} pa_end
+
+#endif
+
+// Wake Behavior Tests
+
+pa_activity (TestEnterProbe, pa_ctx(pa_enter_res), int& entries) {
+    pa_enter {
+        ++entries;
+    };
+    pa_halt;
+} pa_end
+
+pa_activity (TestEnterProbeRun, pa_ctx(pa_use(TestEnterProbe)), int& entries) {
+    pa_run (TestEnterProbe, entries);
+} pa_end
+
+pa_activity (TestDelayArg, pa_ctx_tm(), pa_time_t ms) {
+    pa_delay_ms (ms);
+} pa_end
+
+// Parallel Trail Tests
+
+pa_activity (TestParTrail, pa_ctx(unsigned remaining), unsigned n, unsigned& sum) {
+    pa_self.remaining = n;
+    while (pa_self.remaining-- > 0) {
+        sum += pa_self.remaining;
+        pa_pause;
+    }
+} pa_end
+
+pa_activity (TestPar, pa_ctx(pa_co_res(4); unsigned sums[4] = {};
+                             pa_use_as(TestParTrail, Trail1); pa_use_as(TestParTrail, Trail2);
+                             pa_use_as(TestParTrail, Trail3); pa_use_as(TestParTrail, Trail4))) {
+    pa_co_par(4) {
+        pa_with_par_as (TestParTrail, Trail1, 10, pa_self.sums[0]);
+        pa_with_as (TestParTrail, Trail2, 20, pa_self.sums[1]);
+        // Two trails on one line must not clash.
+        pa_with_weak_par_as (TestParTrail, Trail3, 30, pa_self.sums[2]); pa_with_par_as (TestParTrail, Trail4, 5, pa_self.sums[3]);
+    } pa_co_end;
+    assert(pa_self.sums[0] == 45);
+    assert(pa_self.sums[1] == 190);
+    assert(pa_self.sums[2] == 399);
+    assert(pa_self.sums[3] == 10);
+    assert(!pa_did_abort(Trail1));
+    assert(pa_did_abort(Trail3));
+} pa_end
+
+// Each Tests
+
+pa_activity (TestEach, pa_ctx(pa_use_each(TestLifecycleDeferAct, 2))) {
+    const auto slot = pa_each_add(TestLifecycleDeferAct);
+    pa_tick_each (TestLifecycleDeferAct, false);
+    assert(!did_defer);
+
+    // Test that removing a trail runs its defer.
+    pa_each_remove(TestLifecycleDeferAct, slot);
+    assert(did_defer);
+    assert(pa_each_count(TestLifecycleDeferAct) == 0);
+} pa_end
+
+// Spawn Tests
+
+pa_def_pool(TestLifecycleDeferAct, spawn_pool, 2);
+
+pa_activity (TestSpawnOwner, pa_ctx(pa_spawn_res(TestLifecycleDeferAct)), unsigned spawns, bool await) {
+    pa_always {
+        for (unsigned i = 0; i < spawns; ++i) {
+            pa_spawn(TestLifecycleDeferAct, spawn_pool);
+        }
+        pa_tick_spawned (TestLifecycleDeferAct, await);
+    } pa_always_end;
+} pa_end
+
+// Seq Tests
+
+pa_activity (TestSeqCounter, pa_ctx(unsigned ticks; unsigned start = 7), unsigned& value) {
+    pa_always {
+        value = pa_self.start + pa_self.ticks++;
+    } pa_always_end;
+} pa_end
+
+pa_activity (TestSeqDelay, pa_ctx(unsigned remaining; unsigned scratch)) {
+    pa_self.remaining = 2;
+    pa_self.scratch = 99;
+    while (pa_self.remaining-- > 0) {
+        pa_pause;
+    }
+} pa_end
+
+pa_activity (TestSeq, pa_ctx_tm(unsigned value; pa_use_seq(TestSeqCounter, TestSeqDelay))) {
+#if __cplusplus >= 201703L
+    assert(static_cast<void*>(&pa_self.TestSeqCounter_inst) == static_cast<void*>(&pa_self.TestSeqDelay_inst));
+#endif
+
+    // Test that a frame gets initialized after its predecessor ended.
+    pa_run (TestSeqDelay);
+    pa_after_abort (2, TestSeqCounter, pa_self.value);
+    assert(pa_self.value == 8);
+
+    // Test that a frame gets initialized after its predecessor was aborted.
+    pa_run (TestSeqDelay);
+    pa_after_abort (2, TestSeqCounter, pa_self.value);
+    assert(pa_self.value == 8);
+} pa_end
+
+// Input Tests
+
+pa_activity (TestInputsBody, pa_ctx(), pa_signal& button, pa_val_signal<int>& speed, int& presses, int& last_speed) {
+    pa_always {
+        if (button) {
+            ++presses;
+        }
+        if (speed) {
+            last_speed = speed.val();
+        }
+    } pa_always_end;
+} pa_end
+
 } // namespace tests
 
+// Wake Behavior Tests
+
+void test_wake_behavior() {
+    // Test that an activity with an enter callback is entered on every tick - also in a halt.
+    int entries = 0;
+    pa_use_ns(tests, TestEnterProbeRun);
+    pa_init(TestEnterProbeRun);
+    for (pa_time_t tm = 0; tm < 5; ++tm) {
+        assert(pa_tick_tm(tm, TestEnterProbeRun, entries) == PA_RC_WAIT);
+    }
+    assert(entries == 5);
+
+    // Test that a delay follows changes of its duration argument.
+    pa_use_ns(tests, TestDelayArg);
+    pa_init(TestDelayArg);
+    assert(pa_tick_tm(0, TestDelayArg, 1000) == PA_RC_WAIT);
+    assert(pa_tick_tm(50, TestDelayArg, 100) == PA_RC_WAIT);
+    assert(pa_tick_tm(100, TestDelayArg, 100) == PA_RC_DONE);
+}
+
+// Frame Tests
+
+void test_frame_init() {
+    // Test that a frame which is only default-initialized starts at its beginning.
+    alignas(tests::TestRun_frame) unsigned char storage[sizeof(tests::TestRun_frame)];
+    memset(storage, 0xff, sizeof(storage));
+    auto* frame = new (storage) tests::TestRun_frame;
+    assert(frame->_pa_pc == 0);
+    assert(frame->TestRunTest_inst._pa_pc == 0);
+}
+
+// Batch Tests
+
+void test_batch() {
+    unsigned values[3]{};
+    pa_use_batch_ns(helpers, CountDown, 3);
+    pa_init_batch(CountDown);
+
+    pa_tick_batch(CountDown, pa_batch_i + 1, values[pa_batch_i]);
+    assert(pa_batch_waiting(CountDown) == 3);
+    assert(values[0] == 0 && values[1] == 1 && values[2] == 2);
+
+    pa_tick_batch(CountDown, pa_batch_i + 1, values[pa_batch_i]);
+    assert(pa_batch_waiting(CountDown) == 2);
+    assert(pa_batch_rc(CountDown, 0) == PA_RC_DONE);
+    assert(values[1] == 0 && values[2] == 1);
+
+    pa_tick_batch(CountDown, pa_batch_i + 1, values[pa_batch_i]);
+    pa_tick_batch(CountDown, pa_batch_i + 1, values[pa_batch_i]);
+    assert(pa_batch_waiting(CountDown) == 0);
+}
+
+// Spawn Tests
+
+void test_spawn() {
+    pa_use_ns(tests, TestSpawnOwner);
+
+    // Test that spawning stops once the pool is exhausted.
+    pa_tick(TestSpawnOwner, 2, false);
+    pa_tick(TestSpawnOwner, 1, false);
+    assert(TestSpawnOwner_inst.TestLifecycleDeferAct_spawned.count == 2);
+    assert(!tests::did_defer);
+
+    // Test that finished instances return to the pool.
+    pa_tick(TestSpawnOwner, 0, true);
+    assert(TestSpawnOwner_inst.TestLifecycleDeferAct_spawned.count == 0);
+    assert(tests::did_defer);
+    pa_tick(TestSpawnOwner, 2, false);
+    assert(TestSpawnOwner_inst.TestLifecycleDeferAct_spawned.count == 2);
+
+    // Test that resetting the owner aborts its instances and returns them to the pool.
+    tests::did_defer = false;
+    pa_init(TestSpawnOwner);
+    assert(tests::did_defer);
+    assert(TestSpawnOwner_inst.TestLifecycleDeferAct_spawned.count == 0);
+    pa_tick(TestSpawnOwner, 2, false);
+    assert(TestSpawnOwner_inst.TestLifecycleDeferAct_spawned.count == 2);
+    pa_init(TestSpawnOwner);
+
+    // Test that destroying the owner aborts its instances and returns them to the pool.
+    tests::did_defer = false;
+    {
+        pa_use_ns(tests, TestSpawnOwner);
+        pa_tick(TestSpawnOwner, 2, false);
+        assert(TestSpawnOwner_inst.TestLifecycleDeferAct_spawned.count == 2);
+    }
+    assert(tests::did_defer);
+    pa_tick(TestSpawnOwner, 2, false);
+    assert(TestSpawnOwner_inst.TestLifecycleDeferAct_spawned.count == 2);
+    pa_init(TestSpawnOwner);
+}
+
+// Executor Tests
+
+void test_executor() {
+    helpers::CountDown_frame frames[5]{};
+    unsigned values[5]{};
+
+    proto_activities::Executor executor{3};
+    for (unsigned i = 0; i < 5; ++i) {
+        executor.add([&frames, &values, i](pa_time_t tm) {
+            return helpers::CountDown(&frames[i], tm, i + 1, values[i]);
+        });
+    }
+    assert(executor.shard_of(0) == 0 && executor.shard_of(1) == 1 && executor.shard_of(2) == 2);
+
+    // Test that all roots see the same tick.
+    assert(executor.tick(0) == 5);
+    for (unsigned i = 0; i < 5; ++i) {
+        assert(values[i] == i);
+    }
+    assert(executor.tick(0) == 4);
+    assert(executor.rc(0) == PA_RC_DONE);
+
+    // Test rebalancing.
+    executor.move(4, 0);
+    assert(executor.shard_of(4) == 0);
+    assert(executor.tick(0) == 3);
+    assert(executor.tick(0) == 2);
+    assert(executor.tick(0) == 1);
+    assert(executor.tick(0) == 0);
+    assert(executor.shard_max_latency(0) >= executor.shard_latency(0));
+}
+
+// Thunk Tests
+
+struct Payload {
+    static int constructions;
+    static int destructions;
+    std::vector<int> points;
+
+    Payload(size_t n) : points(n) { ++constructions; }
+    Payload(const Payload& other) : points(other.points) { ++constructions; }
+    Payload(const std::vector<int>& view) : points(view) { ++constructions; }
+    Payload& operator=(const Payload& other) {
+        points = other.points;
+        return *this;
+    }
+    Payload& operator=(const std::vector<int>& view) {
+        points.assign(view.begin(), view.end());
+        return *this;
+    }
+    ~Payload() { ++destructions; }
+};
+int Payload::constructions = 0;
+int Payload::destructions = 0;
+
+struct PayloadSignals_frame {
+    proto_activities::internal::Epoch _pa_enter{};
+    pa_val_signal<Payload> sig{_pa_enter};
+    pa_val_signal<std::string> name{_pa_enter};
+};
+
+void test_val_signal() {
+    static_assert(std::is_trivially_destructible<pa_val_signal<int>>::value, "trivial values keep signals trivial");
+    PayloadSignals_frame frame;
+
+    // Test that defining and resetting a signal leaves the value unconstructed.
+    frame = PayloadSignals_frame{};
+    assert(Payload::constructions == 0 && Payload::destructions == 0);
+    assert(!frame.sig.has_emitted_val());
+
+    // Test that the value is constructed in place on the first emit only.
+    Payload& payload = frame.sig.emplace(size_t{3});
+    assert(frame.sig && frame.sig.val().points.size() == 3);
+
+    // Test that emitting again from a view reuses the storage of the value.
+    const std::vector<int> view{1, 2};
+    const auto capacity = payload.points.capacity();
+    const size_t allocs = allocations;
+    frame._pa_enter.invoke();
+    assert(!frame.sig);
+    frame.sig.emit(view);
+    assert(frame.sig && frame.sig.val().points.size() == 2);
+    assert(frame.sig.val().points.capacity() == capacity);
+    assert(Payload::constructions == 1);
+    assert(allocations == allocs);
+
+    // Test emits from a const reference and from a string literal.
+    const Payload other{1};
+    frame.sig.emit(other);
+    assert(Payload::constructions == 2 && frame.sig.val().points.size() == 1);
+    frame.name.emit("emitted");
+    assert(frame.name.val() == "emitted");
+
+    // Test that a reset destroys the emitted value only.
+    frame = PayloadSignals_frame{};
+    assert(!frame.sig.has_emitted_val() && !frame.name.has_emitted_val());
+    assert(Payload::destructions == 1);
+}
+
+void test_thunk() {
+    using proto_activities::internal::Thunk;
+    static_assert(sizeof(Thunk) == sizeof(void*) + PA_THUNK_CAPACITY, "a thunk adds only its ops pointer to the captures");
+    int a = 0, b = 0, c = 0;
+    const size_t allocs = allocations;
+
+    // Test that captures are stored inline.
+    Thunk thunk = [&a, &b, &c] { ++a; ++b; ++c; };
+    Thunk moved = std::move(thunk);
+    assert(!thunk && moved);
+    moved();
+    assert(a == 1 && b == 1 && c == 1);
+    moved = nullptr;
+    assert(!moved);
+    assert(allocations == allocs);
+}
+
+// Input Queue Tests
+
+void test_input_queue() {
+    proto_activities::InputQueue<4> inputs;
+    pa_signal button{inputs.signals()};
+    pa_val_signal<int> speed{inputs.signals()};
+    int presses = 0;
+    int last_speed = 0;
+    pa_use_ns(tests, TestInputsBody);
+
+    // Test that inputs are present in the next tick only.
+    assert(inputs.emit(button));
+    assert(inputs.emit(speed, 42));
+    assert(inputs.drain() == 2);
+    pa_tick(TestInputsBody, button, speed, presses, last_speed);
+    assert(presses == 1 && last_speed == 42);
+    assert(inputs.drain() == 0);
+    pa_tick(TestInputsBody, button, speed, presses, last_speed);
+    assert(presses == 1 && !speed);
+
+    // Test that the queue is bounded.
+    for (int i = 0; i < 4; ++i) {
+        assert(inputs.emit(speed, i));
+    }
+    assert(!inputs.emit(button));
+    assert(inputs.drain() == 4);
+    assert(speed.val() == 3);
+
+    // Test that values convert to the type of the signal.
+    pa_val_signal<float> ratio{inputs.signals()};
+    assert(inputs.emit(ratio, 0.5));
+    assert(inputs.drain() == 1);
+    assert(ratio.val() == 0.5f);
+
+    // Test concurrent producers.
+    std::thread producers[3];
+    for (auto& producer : producers) {
+        producer = std::thread([&] {
+            for (int i = 0; i < 1000; ++i) {
+                while (!inputs.emit(speed, i)) {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+    size_t drained = 0;
+    while (drained < 3000) {
+        drained += inputs.drain();
+    }
+    for (auto& producer : producers) {
+        producer.join();
+    }
+    assert(inputs.drain() == 0);
+}
+
+#ifdef _PA_ENABLE_CORO
+
+// Coroutine Tests
+
+namespace coro_tests {
+
+using proto_activities::coro::Activity;
+
+Activity Blink(int& on_ticks, int times) {
+    for (int i = 0; i < times; ++i) {
+        ++on_ticks;
+        co_await proto_activities::coro::pause;
+    }
+}
+
+Activity Main(int& on_ticks, bool& go, int& stage) {
+    co_await proto_activities::coro::await([&] { return go; });
+    stage = 1;
+    co_await Blink(on_ticks, 2);
+    stage = 2;
+    co_await proto_activities::coro::co(Blink(on_ticks, 1), Blink(on_ticks, 3));
+    stage = 3;
+}
+
+} // namespace coro_tests
+
+void test_coro() {
+    int on_ticks = 0;
+    bool go = false;
+    int stage = 0;
+    auto main = coro_tests::Main(on_ticks, go, stage);
+
+    // Test await.
+    assert(main.tick() == PA_RC_WAIT && stage == 0);
+    assert(main.tick() == PA_RC_WAIT && stage == 0);
+    go = true;
+
+    // Test sub-activities.
+    assert(main.tick() == PA_RC_WAIT && stage == 1 && on_ticks == 1);
+    assert(main.tick() == PA_RC_WAIT && stage == 1 && on_ticks == 2);
+
+    // Test concurrent trails.
+    assert(main.tick() == PA_RC_WAIT && stage == 2 && on_ticks == 4);
+    assert(main.tick() == PA_RC_WAIT && on_ticks == 5);
+    assert(main.tick() == PA_RC_WAIT && on_ticks == 6);
+    assert(main.tick() == PA_RC_DONE && stage == 3);
+    assert(main.tick() == PA_RC_DONE);
+
+    // Test running a macro based activity.
+    pa_use_ns(helpers, Delay);
+    auto delay = proto_activities::coro::run([&] { return pa_tick(Delay, 2u); });
+    assert(delay.tick() == PA_RC_WAIT);
+    assert(delay.tick() == PA_RC_WAIT);
+    assert(delay.tick() == PA_RC_DONE);
+}
+
+#endif
+
 // Test Driver
 
 #define run_test(ns, nm) \
@@ -911,11 +1547,46 @@ int main(int argc, char* argv[]) {
     run_test(tests, TestWhenAbort);
     run_test(tests, TestWhenReset);
     run_test(tests, TestEvery);
-    run_test(tests, TestLifecycle);
+    {
+        // Test that lifecycle callbacks do not allocate.
+        const size_t allocs = allocations;
+        run_test(tests, TestLifecycle);
+        assert(allocations == allocs);
+    }
     run_test(tests, TestSignals);
+    run_test(tests, TestSignalSet);
+    {
+        // Test that combining emits does not allocate.
+        const size_t allocs = allocations;
+        run_test(tests, TestCombinedSignals);
+        assert(allocations == allocs);
+    }
+    run_test(tests, TestSeq);
+    run_test(tests, TestEach);
+    run_test(tests, TestPar);
+    {
+        proto_activities::TrailPool pool{3};
+        proto_activities::set_trail_pool(&pool);
+        run_test(tests, TestPar);
+        proto_activities::set_trail_pool(nullptr);
+    }
+    test_wake_behavior();
+    test_frame_init();
+    test_batch();
+    test_spawn();
+    test_executor();
+    test_input_queue();
+    test_thunk();
+    test_val_signal();
+#ifdef _PA_ENABLE_CORO
+    test_coro();
+#endif
 #if __cplusplus >= 201703L
     run_test(tests, TestValSignals);
 #endif
+#ifdef PA_USE_WAKE_SETS
+    run_test(tests, TestWake);
+#endif
 
     std::cout << "Done" << std::endl;
 